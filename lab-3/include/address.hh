@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace mmu {
+
+/// The number of characters in the textual representation of an address.
+inline constexpr std::size_t address_width = 6;
+
+/// Writes a textual representation of `a`, which is an address, to the `address_width` characters
+/// starting at `out` and returns a pointer past the last written character.
+///
+/// The representation is `0x` followed by 4 lowercase hexadecimal digits. The function neither
+/// allocates nor depends on the state of any stream, so that it can be used in tight loops.
+inline constexpr char* format_address(char* out, std::uint16_t a) {
+  constexpr char digits[] = "0123456789abcdef";
+  out[0] = '0';
+  out[1] = 'x';
+  for (std::size_t i = 0; i < 4; ++i) { out[2 + i] = digits[(a >> (12 - 4 * i)) & 0xf]; }
+  return out + address_width;
+}
+
+/// Writes a textual representation of `a`, which is an address, to `o`.
+///
+/// The format state of `o` is neither used nor modified.
+inline std::ostream& write_address(std::ostream& o, std::uint16_t a) {
+  char text[address_width];
+  format_address(text, a);
+  return o.write(text, address_width);
+}
+
+} // namespace mmu
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "trace.hh"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace mmu {
+
+/// The reuse profile of a sequence of memory accesses.
+///
+/// A reuse profile is computed in a single pass over a trace and summarizes the locality of the
+/// accesses at page granularity. It records two histograms:
+///
+/// - The *reuse distance* of an access to a page `p` is the number of distinct pages accessed since
+///   the last access to `p`. An access hits in a LRU cache of `c` pages iff its reuse distance is
+///   less than `c`. Hence, the miss ratio of any cache size can be read from the histogram of reuse
+///   distances (Mattson's stack algorithm).
+/// - The *reuse interval* of an access to a page `p` is the number of accesses since the last
+///   access to `p`. The average size of the working set for a window of `τ` accesses is the sum of
+///   the fraction of intervals greater than `k`, for all `k < τ` (Denning and Schwartz).
+///
+/// The first access to a page has an infinite distance and interval; it is counted as a "cold"
+/// access.
+///
+/// Both main memory and the TLB cache pages, so the same profile predicts the miss ratio for any
+/// frame count and any TLB size. The prediction is an estimate since neither the clock algorithm
+/// used to steal frames (see `FrameDescriptor`) nor the transposition heuristic used by the TLB
+/// are exactly LRU.
+///
+/// Optionally, the profile can be computed on a spatially hashed sample of the pages (SHARDS). A
+/// page is tracked iff its hash is below a threshold that is proportional to the sampling rate,
+/// and the accesses to sampled pages are scaled by the inverse of that rate.
+struct ReuseProfile {
+
+  /// The number of pages in the virtual address space.
+  static constexpr std::size_t page_count = 256;
+
+  /// The sampling threshold, as a fraction of `page_count`.
+  std::uint16_t threshold;
+
+  /// The LRU stack of sampled pages, most recently used first.
+  std::array<std::uint8_t, page_count> stack = {};
+
+  /// The number of pages in `stack`.
+  std::size_t depth = 0;
+
+  /// The time of the last access to each page, or 0 if the page has not been accessed yet.
+  std::array<std::uint64_t, page_count> last_access = {};
+
+  /// The number of accesses observed so far, including those that were not sampled.
+  std::uint64_t clock = 0;
+
+  /// The (scaled) number of accesses whose reuse distance is `d`, for all `d < page_count`.
+  std::array<double, page_count> distances = {};
+
+  /// The (scaled) number of accesses whose reuse interval is `k + 1`, for all `k` less than the
+  /// size of this array. The last element counts intervals greater than the size of the array.
+  std::vector<double> intervals;
+
+  /// The (scaled) number of cold accesses.
+  double cold = 0;
+
+  /// The (scaled) number of sampled accesses.
+  double total = 0;
+
+  /// Creates an instance sampling pages at the given `rate`, in the range `(0, 1]`, and recording
+  /// intervals up to `window_limit` accesses.
+  ReuseProfile(double rate = 1.0, std::size_t window_limit = 4096)
+    : threshold(static_cast<std::uint16_t>(std::clamp(rate, 0.0, 1.0) * page_count)),
+      intervals(window_limit + 1, 0)
+  {
+    assert(threshold > 0);
+  }
+
+  /// Returns the hash of the page `p`, in the range `[0, page_count)`.
+  static constexpr std::uint8_t hash(std::uint8_t p) {
+    return static_cast<std::uint8_t>((p * 0x9e3779b1u) >> 24);
+  }
+
+  /// Returns the fraction of the pages that are sampled.
+  inline double rate() const {
+    return static_cast<double>(threshold) / page_count;
+  }
+
+  /// Records an access to `va`.
+  void observe(VirtualAddress va) {
+    auto const p = static_cast<std::uint8_t>(va.raw >> 8);
+    auto const t = ++clock;
+    if (hash(p) >= threshold) { return; }
+
+    auto const w = 1.0 / rate();
+    total += w;
+
+    // Is it the first access to this page?
+    if (last_access[p] == 0) {
+      cold += w;
+      std::copy_backward(stack.begin(), stack.begin() + depth, stack.begin() + depth + 1);
+      stack[0] = p;
+      depth++;
+    }
+
+    // Otherwise, the position of `p` in the stack is its reuse distance among sampled pages.
+    else {
+      auto const i = static_cast<std::size_t>(std::distance(
+        stack.begin(), std::find(stack.begin(), stack.begin() + depth, p)));
+      assert(i < depth);
+      std::copy_backward(stack.begin(), stack.begin() + i, stack.begin() + i + 1);
+      stack[0] = p;
+
+      auto const d = std::min(static_cast<std::size_t>(i * w), page_count - 1);
+      distances[d] += w;
+
+      auto const k = std::min(t - last_access[p] - 1, intervals.size() - 1);
+      intervals[k] += w;
+    }
+
+    last_access[p] = t;
+  }
+
+  /// Returns the expected miss ratio of a LRU cache holding `capacity` pages.
+  double miss_ratio(std::size_t capacity) const {
+    if (total == 0) { return 0; }
+    auto misses = cold;
+    for (auto d = std::min(capacity, page_count); d < page_count; ++d) { misses += distances[d]; }
+    return misses / total;
+  }
+
+  /// Returns the miss ratios of LRU caches holding from 0 to `max_capacity` pages.
+  std::vector<double> miss_ratio_curve(std::size_t max_capacity = page_count) const {
+    if (total == 0) { return std::vector<double>(max_capacity + 1, 0); }
+    std::vector<double> curve(max_capacity + 1, cold / total);
+
+    // Accumulate the misses from the largest capacity down.
+    auto misses = cold;
+    for (auto d = page_count; d > 0; --d) {
+      if (d <= max_capacity) { curve[d] = misses / total; }
+      misses += distances[d - 1];
+    }
+    curve[0] = misses / total;
+    return curve;
+  }
+
+  /// Returns the average number of distinct pages accessed in a window of `window` accesses.
+  ///
+  /// `window` must not exceed the limit passed at construction.
+  double working_set_size(std::size_t window) const {
+    assert(window < intervals.size());
+    if (total == 0) { return 0; }
+
+    // `s(τ + 1) = s(τ) + m(τ)`, where `m(τ)` is the fraction of intervals greater than `τ`.
+    auto greater = total;
+    double s = 0;
+    for (std::size_t k = 0; k < window; ++k) {
+      s += greater / total;
+      greater -= intervals[k];
+    }
+    return s;
+  }
+
+};
+
+/// Returns the reuse profile of `trace`, sampling pages at the given `rate`.
+inline ReuseProfile profile(std::span<Access const> trace, double rate = 1.0) {
+  ReuseProfile r(rate);
+  for (auto const& a : trace) { r.observe(a.va); }
+  return r;
+}
+
+/// Replays `trace` on `m` and returns its reuse profile, sampling pages at the given `rate`.
+inline ReuseProfile profile(Machine& m, std::span<Access const> trace, double rate = 1.0) {
+  ReuseProfile r(rate);
+  replay(m, trace, [&](Access const& a, PhysicalAddress) { r.observe(a.va); });
+  return r;
+}
+
+} // namespace mmu
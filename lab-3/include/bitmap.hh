@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace mmu {
+
+/// A set of `n` bits, one per frame, stored in 64-bit words so that it can be searched and updated
+/// a word at a time.
+///
+/// Unlike `std::bitset`, the type exposes its words and offers a search for the next set bit,
+/// which takes `n / 64` word comparisons and a single count of trailing zeros.
+template<std::size_t n>
+struct FrameBitset {
+
+  /// The number of bits in a word.
+  static constexpr std::size_t word_size = 64;
+
+  /// The number of words storing the bits.
+  static constexpr std::size_t word_count = (n + word_size - 1) / word_size;
+
+  /// The words storing the bits; the bits past `n` in the last word are always clear.
+  std::array<std::uint64_t, word_count> words = {};
+
+  /// Returns the value of the `i`-th bit.
+  inline constexpr bool test(std::size_t i) const {
+    return (words[i / word_size] >> (i % word_size)) & 1;
+  }
+
+  /// Sets the value of the `i`-th bit to `v`.
+  inline constexpr void set(std::size_t i, bool v = true) {
+    auto const m = std::uint64_t{1} << (i % word_size);
+    words[i / word_size] = v ? (words[i / word_size] | m) : (words[i / word_size] & ~m);
+  }
+
+  /// Clears all bits.
+  inline constexpr void reset() {
+    words = {};
+  }
+
+  /// Returns the number of set bits.
+  constexpr std::size_t count() const {
+    std::size_t result = 0;
+    for (auto w : words) { result += static_cast<std::size_t>(std::popcount(w)); }
+    return result;
+  }
+
+  /// Returns the index of the first set bit at or after `i`, or `n` if there is none.
+  ///
+  /// If `inverted` is `true`, the method searches for the first clear bit instead.
+  constexpr std::size_t find_next(std::size_t i, bool inverted = false) const {
+    if (i >= n) { return n; }
+    auto w = i / word_size;
+    auto x = (inverted ? ~words[w] : words[w]) & (~std::uint64_t{0} << (i % word_size));
+    while (x == 0) {
+      if (++w == word_count) { return n; }
+      x = inverted ? ~words[w] : words[w];
+    }
+    auto const result = w * word_size + static_cast<std::size_t>(std::countr_zero(x));
+    return (result < n) ? result : n;
+  }
+
+  /// Returns the index of the first clear bit at or after `i`, or `n` if there is none.
+  inline constexpr std::size_t find_next_clear(std::size_t i) const {
+    return find_next(i, true);
+  }
+
+  /// Clears the bits whose indices are in the range from `first` to `last`, excluded.
+  constexpr void clear_range(std::size_t first, std::size_t last) {
+    while (first < last) {
+      auto const w = first / word_size;
+      auto const end = std::min(last, (w + 1) * word_size);
+      auto const width = end - first;
+      auto const m = (width == word_size)
+        ? ~std::uint64_t{0}
+        : ((std::uint64_t{1} << width) - 1) << (first % word_size);
+      words[w] &= ~m;
+      first = end;
+    }
+  }
+
+};
+
+} // namespace mmu
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace mmu {
+
+/// A set-associative cache indexed and tagged by physical addresses.
+///
+/// The cache only models the placement of lines, not their contents, which always reside in the
+/// main memory of the machine. It is therefore suitable to estimate hit ratios and latencies but
+/// has no effect on the values being read or written.
+///
+/// Lines are replaced in LRU order within a set. Writes are handled according to the write policy
+/// of the cache: a write-back cache marks lines dirty and writes them to the next level upon
+/// eviction, whereas a write-through cache forwards every write to the next level. A write miss
+/// allocates a line iff the cache is write-allocate.
+struct Cache {
+
+  /// The configuration of a cache.
+  struct Configuration {
+
+    /// The size of a line, in bytes, which must be a power of 2.
+    std::size_t line_size = 16;
+
+    /// The number of sets, or 0 if the cache is disabled.
+    std::size_t set_count = 0;
+
+    /// The number of lines in each set.
+    std::size_t associativity = 1;
+
+    /// `true` iff writes are absorbed by dirty lines rather than forwarded to the next level.
+    bool write_back = true;
+
+    /// `true` iff write misses allocate a line.
+    bool write_allocate = true;
+
+  };
+
+  /// A line of the cache.
+  struct Line {
+
+    /// The tag of the line.
+    std::uint64_t tag;
+
+    /// The time of the last access to the line.
+    std::uint64_t last_use;
+
+    /// `true` iff the line holds data.
+    bool valid;
+
+    /// `true` iff the line has been written since it was filled.
+    bool dirty;
+
+  };
+
+  /// Statistics about a cache.
+  struct Statistics {
+
+    /// The number of reads that hit.
+    std::size_t read_hits = 0;
+
+    /// The number of reads that missed.
+    std::size_t read_misses = 0;
+
+    /// The number of writes that hit.
+    std::size_t write_hits = 0;
+
+    /// The number of writes that missed.
+    std::size_t write_misses = 0;
+
+    /// The number of dirty lines written to the next level upon eviction.
+    std::size_t writebacks = 0;
+
+    /// Returns the fraction of accesses that hit, or 0 if there was no access.
+    inline double hit_ratio() const {
+      auto const hits = read_hits + write_hits;
+      auto const total = hits + read_misses + write_misses;
+      return (total == 0) ? 0.0 : static_cast<double>(hits) / total;
+    }
+
+  };
+
+  /// The outcome of an access.
+  struct Result {
+
+    /// `true` iff the access hit.
+    bool hit;
+
+    /// `true` iff the access must be forwarded to the next level.
+    bool forward;
+
+    /// `true` iff the forwarded access is a write; otherwise, it fills a line.
+    bool forward_write;
+
+    /// The address of a dirty line that has been evicted, which must be written to the next level.
+    std::optional<std::uint64_t> writeback;
+
+  };
+
+  /// The configuration of the cache.
+  Configuration configuration;
+
+  /// The lines of the cache, grouped by set.
+  std::vector<Line> lines;
+
+  /// The number of accesses so far, used as a clock for LRU replacement.
+  std::uint64_t clock = 0;
+
+  /// Statistics about the cache.
+  Statistics statistics;
+
+  /// Creates a disabled cache.
+  Cache() = default;
+
+  /// Creates a cache with the given configuration.
+  Cache(Configuration c)
+    : configuration(c), lines(c.set_count * c.associativity, Line{})
+  {
+    assert((c.line_size > 0) && ((c.line_size & (c.line_size - 1)) == 0));
+    assert((c.set_count == 0) || (c.associativity > 0));
+  }
+
+  /// Returns `true` iff the cache is enabled.
+  inline bool is_enabled() const {
+    return configuration.set_count != 0;
+  }
+
+  /// Returns the total size of the cache, in bytes.
+  inline std::size_t size() const {
+    return lines.size() * configuration.line_size;
+  }
+
+  /// Accesses the line containing `address`, for writing iff `write` is `true`.
+  Result access(std::uint64_t address, bool write) {
+    auto const& c = configuration;
+    auto const block = address / c.line_size;
+    auto const set = block % c.set_count;
+    auto const tag = block / c.set_count;
+    auto* const first = lines.data() + set * c.associativity;
+    auto* const last = first + c.associativity;
+    ++clock;
+
+    // Is the line in the cache?
+    auto* line = std::find_if(first, last, [&](auto const& l) { return l.valid && l.tag == tag; });
+    if (line != last) {
+      (write ? statistics.write_hits : statistics.read_hits)++;
+      line->last_use = clock;
+      if (write && c.write_back) { line->dirty = true; }
+      return {true, write && !c.write_back, write, std::nullopt};
+    }
+
+    // The access missed.
+    (write ? statistics.write_misses : statistics.read_misses)++;
+    if (write && !c.write_allocate) { return {false, true, true, std::nullopt}; }
+
+    // Replace an invalid line or the least recently used one.
+    line = std::min_element(first, last, [](auto const& a, auto const& b) {
+      return (a.valid ? a.last_use + 1 : 0) < (b.valid ? b.last_use + 1 : 0);
+    });
+    std::optional<std::uint64_t> writeback;
+    if (line->valid && line->dirty) {
+      writeback = (line->tag * c.set_count + set) * c.line_size;
+      statistics.writebacks++;
+    }
+    *line = {tag, clock, true, write && c.write_back};
+    return {false, true, write && !c.write_back, writeback};
+  }
+
+};
+
+/// A hierarchy of two caches between the CPU and main memory.
+///
+/// Either cache can be disabled, in which case accesses go directly to the next level.
+struct CacheHierarchy {
+
+  /// The first level, closest to the CPU.
+  Cache l1;
+
+  /// The second level.
+  Cache l2;
+
+  /// Returns `true` iff at least one level is enabled.
+  inline bool is_enabled() const {
+    return l1.is_enabled() || l2.is_enabled();
+  }
+
+  /// Accesses `address`, for writing iff `write` is `true`, calling `visit(i)` each time the
+  /// access reaches the `i`-th level of the hierarchy, where the level 2 is main memory.
+  template<typename F>
+  void access(std::uint64_t address, bool write, F&& visit) {
+    access(0, address, write, visit);
+  }
+
+private:
+
+  /// Implements `access` from the `i`-th level.
+  template<typename F>
+  void access(std::size_t i, std::uint64_t address, bool write, F& visit) {
+    if (i == 2) { visit(i); return; }
+    auto& c = (i == 0) ? l1 : l2;
+    if (!c.is_enabled()) { access(i + 1, address, write, visit); return; }
+
+    visit(i);
+    auto const r = c.access(address, write);
+    if (r.writeback) { access(i + 1, *r.writeback, true, visit); }
+    if (r.forward) { access(i + 1, address, r.forward_write, visit); }
+  }
+
+};
+
+} // namespace mmu
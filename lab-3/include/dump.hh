@@ -0,0 +1,148 @@
+#pragma once
+
+#include "invariants.hh"
+#include "mmu.hh"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+namespace mmu {
+
+/// A buffer accumulating text that is written to a stream in blocks.
+///
+/// Values are formatted with `format_address` and `std::to_chars` directly into the buffer, which
+/// is flushed when it is full and when the instance is destroyed. Hence, dumping large tables
+/// neither allocates nor touches the format state of the stream, and issues one write per block.
+struct TextBuffer {
+
+  /// The number of characters in the buffer.
+  static constexpr std::size_t capacity = 4096;
+
+  /// The stream to which the buffer is flushed.
+  std::ostream& o;
+
+  /// The contents of the buffer.
+  std::array<char, capacity> data;
+
+  /// The number of characters in `data`.
+  std::size_t size = 0;
+
+  /// Creates an instance flushed to `o`.
+  explicit TextBuffer(std::ostream& o) : o(o) {}
+
+  TextBuffer(TextBuffer const&) = delete;
+  TextBuffer& operator=(TextBuffer const&) = delete;
+
+  /// Flushes the buffer.
+  ~TextBuffer() {
+    flush();
+  }
+
+  /// Writes the contents of the buffer to the stream and empties it.
+  void flush() {
+    o.write(data.data(), static_cast<std::streamsize>(size));
+    size = 0;
+  }
+
+  /// Returns a pointer to `n` free characters at the end of the buffer, flushing it if needed.
+  ///
+  /// - Requires: `n` is at most `capacity`.
+  inline char* reserve(std::size_t n) {
+    if (size + n > capacity) { flush(); }
+    return data.data() + size;
+  }
+
+  /// Appends `c`.
+  inline TextBuffer& put(char c) {
+    *reserve(1) = c;
+    size += 1;
+    return *this;
+  }
+
+  /// Appends `s`, which is at most `capacity` characters long.
+  inline TextBuffer& text(std::string_view s) {
+    auto* out = reserve(s.size());
+    std::copy(s.begin(), s.end(), out);
+    size += s.size();
+    return *this;
+  }
+
+  /// Appends the textual representation of the address `a` (see `format_address`).
+  inline TextBuffer& address(std::uint16_t a) {
+    format_address(reserve(address_width), a);
+    size += address_width;
+    return *this;
+  }
+
+  /// Appends the decimal representation of `n`.
+  inline TextBuffer& decimal(std::uint64_t n) {
+    auto* out = reserve(20);
+    size += static_cast<std::size_t>(std::to_chars(out, out + 20, n).ptr - out);
+    return *this;
+  }
+
+};
+
+/// Writes the page entries of the translation table of `m` to `o`, one per line.
+///
+/// Each line lists the first address mapped by the entry, the level of the table at which it is
+/// stored, its raw value, its flags (`p`resent, `r`ead, `w`rite, e`x`ecute, and `f`ile-backed),
+/// and the frame, slot, or page cache identifier it refers to. A large page is marked `L`.
+inline void dump_page_table(std::ostream& o, Machine& m) {
+  TextBuffer b(o);
+  for_each_page_entry(m, [&](VirtualAddress va, std::uint16_t* pda, std::size_t level) {
+    auto const pte = *rebind<PageEntry>(pda);
+    b.address(va.raw).text(" L").decimal(level).put(' ').address(pte.raw).put(' ');
+    if (pte.is_guard()) { b.text("guard\n"); return; }
+
+    char const flags[] = {
+      pte.is_present() ? 'p' : '-',
+      (pte.protection() & PageEntry::read) ? 'r' : '-',
+      (pte.protection() & PageEntry::write) ? 'w' : '-',
+      (pte.protection() & PageEntry::execute) ? 'x' : '-',
+      pte.is_file_backed() ? 'f' : '-',
+      Machine::is_large_page_level(va, level) ? 'L' : '-',
+    };
+    b.text({flags, sizeof(flags)}).put(' ').decimal(pte.frame()).put('\n');
+  });
+}
+
+/// Writes the entries of the TLB of `m` to `o`, most recently used first, one per line.
+///
+/// Each line lists the page-aligned address of the entry, the raw value of the cached page entry,
+/// and the frame it refers to. Empty entries are skipped.
+inline void dump_tlb(std::ostream& o, Machine& m) {
+  TextBuffer b(o);
+  for (std::size_t i = 0; i < Machine::tlb_size; ++i) {
+    auto const [key, value] = m.tlb[i];
+    if ((key == 0) && (value == 0)) { continue; }
+    auto const pte = PageEntry::from_raw(value);
+    b.address(key).put(' ').address(value).put(' ').decimal(pte.frame()).put('\n');
+  }
+}
+
+/// Writes the frame table of `m` to `o`, one frame per line.
+///
+/// Each line lists the index of a frame, its state (`free` or `used`), its flags (`r`eferenced and
+/// `p`inned), its page cache identifier, and the addresses of the page entries referring to it.
+inline void dump_frame_table(std::ostream& o, Machine& m) {
+  TextBuffer b(o);
+  auto const free_map = m.free_map();
+  auto const* frame_table = m.frame_table();
+  for (std::uint16_t f = 0; f < 16; ++f) {
+    auto const& d = frame_table[f];
+    b.decimal(f).text((free_map & (1 << f)) ? " free " : " used ");
+    b.put(d.is_referenced() ? 'r' : '-').put(d.is_pinned() ? 'p' : '-');
+    b.put(' ').decimal(d.permanent_position());
+    auto const n = std::min<std::size_t>(d.back_reference_count(), 2);
+    for (std::size_t i = 0; i < n; ++i) { b.put(' ').address(d.back_reference(i)); }
+    b.put('\n');
+  }
+}
+
+} // namespace mmu
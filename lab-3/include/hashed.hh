@@ -0,0 +1,149 @@
+#pragma once
+
+#include "radix.hh"
+
+#include <bit>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace mmu {
+
+/// A hashed inverted page translation table for an address space whose shape is described by `G`.
+///
+/// The table has one slot per frame of main memory, storing the address of the page held by that
+/// frame together with its entry. Slots are found by hashing the page number into an anchor table
+/// whose elements start chains of slots linked by index. Hence, the size of the table is
+/// proportional to the size of main memory rather than to the size of the address space, and a
+/// lookup costs one probe per element in the chain instead of one per level.
+///
+/// Since a frame can only describe a resident page, the entries of the pages that have been
+/// swapped out are kept in a separate hash map, as an operating system would do in its swap map.
+///
+/// The table is a drop-in replacement for `RadixPageTable` (see `WideMachine`):
+///
+///     WideMachine<Geometry48, HashedPageTable> m;
+template<typename G>
+struct HashedPageTable {
+
+  /// The type of an address.
+  using Address = typename G::address_type;
+
+  /// The type of a page entry.
+  using Entry = BasicPageEntry<std::uint64_t>;
+
+  /// The slot of a frame.
+  struct Slot {
+
+    /// The address of the page held by the frame.
+    Address page;
+
+    /// The entry of that page, or a "none" value if the frame is free.
+    Entry entry;
+
+    /// One plus the index of the next slot in the chain, or 0 if this slot is the last.
+    std::uint32_t next;
+
+  };
+
+  /// The slot of each frame.
+  std::vector<Slot> slots;
+
+  /// One plus the index of the first slot of each chain, or 0 if the chain is empty.
+  std::vector<std::uint32_t> anchors;
+
+  /// The entries of the pages that are not resident.
+  std::unordered_map<Address, Entry> swapped;
+
+  /// The number of slots and swap map entries visited by `find`.
+  std::uint64_t steps = 0;
+
+  /// Creates an empty table for a main memory of `frame_count` frames.
+  ///
+  /// The anchor table has at least twice as many elements as there are frames, which keeps the
+  /// chains short.
+  HashedPageTable(std::size_t frame_count)
+    : slots(frame_count), anchors(std::bit_ceil(2 * frame_count))
+  {}
+
+  /// Returns a pointer to the entry of the page containing `va`, or `nullptr` if that page is not
+  /// mapped.
+  Entry* find(Address va) {
+    auto const page = G::page(va);
+    for (auto i = anchors[hash(page)]; i != 0; i = slots[i - 1].next) {
+      ++steps;
+      if (slots[i - 1].page == page) { return &slots[i - 1].entry; }
+    }
+
+    ++steps;
+    auto const s = swapped.find(page);
+    return (s != swapped.end()) ? &s->second : nullptr;
+  }
+
+  /// Maps the page containing `va` to `e`.
+  ///
+  /// If `e` is present, the slot of the frame it refers to must be free.
+  void assign(Address va, Entry e) {
+    assert(!e.is_none());
+    auto const page = G::page(va);
+    erase(page);
+
+    if (e.is_present()) {
+      auto const f = static_cast<std::uint32_t>(e.frame());
+      assert(slots[f].entry.is_none());
+      auto& a = anchors[hash(page)];
+      slots[f] = {page, e, a};
+      a = f + 1;
+    } else {
+      swapped[page] = e;
+    }
+  }
+
+  /// Removes the mapping of the page containing `va`, if any.
+  void erase(Address va) {
+    auto const page = G::page(va);
+    for (auto* i = &anchors[hash(page)]; *i != 0; i = &slots[*i - 1].next) {
+      auto& s = slots[*i - 1];
+      if (s.page == page) {
+        *i = s.next;
+        s = {};
+        return;
+      }
+    }
+    swapped.erase(page);
+  }
+
+  /// Calls `action(page, e)` for each mapped page, where `page` is the address of the page and `e`
+  /// is its entry, in unspecified order.
+  template<typename F>
+  void for_each(F&& action) {
+    for (auto& s : slots) {
+      if (!s.entry.is_none()) { action(s.page, s.entry); }
+    }
+    for (auto& [page, e] : swapped) { action(page, e); }
+  }
+
+  /// Returns the number of bytes occupied by the table.
+  ///
+  /// The size of the swap map is estimated as the size of its elements and buckets, ignoring the
+  /// bookkeeping of the allocator.
+  std::size_t footprint() const {
+    using Node = typename decltype(swapped)::value_type;
+    return slots.size() * sizeof(Slot)
+      + anchors.size() * sizeof(std::uint32_t)
+      + swapped.size() * (sizeof(Node) + sizeof(void*))
+      + swapped.bucket_count() * sizeof(void*);
+  }
+
+private:
+
+  /// Returns the index of the chain of `page` in the anchor table.
+  std::size_t hash(Address page) const {
+    auto const vpn = static_cast<std::uint64_t>(page) >> G::page_shift;
+    auto const bits = static_cast<unsigned>(std::countr_zero(anchors.size()));
+    return static_cast<std::size_t>((vpn * 0x9e3779b97f4a7c15u) >> (64 - bits));
+  }
+
+};
+
+} // namespace mmu
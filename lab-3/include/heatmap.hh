@@ -0,0 +1,161 @@
+#pragma once
+
+#include "address.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ios>
+#include <ostream>
+
+namespace mmu {
+
+/// The temperature of a page, according to the time since it was last accessed.
+enum class Temperature : std::uint8_t { cold, warm, hot };
+
+/// Per-page counters of the accesses to the virtual address space of a machine.
+///
+/// The counters are indexed by virtual page number and updated by `Machine::translate` with a few
+/// increments per access. The time is measured in accesses, so that a page is *hot* if it has been
+/// touched within the last `hot_age` accesses and *cold* if it has not been touched within the
+/// last `cold_age` accesses, or ever.
+///
+/// Evictions are attributed to the page last accessed through the evicted frame, which is the
+/// page stored in that frame unless it is shared by several mappings. If `interval` is nonzero,
+/// `observer` is called every `interval` accesses, e.g., to dump the counters as a time series.
+struct PageHeatmap {
+
+  /// The number of pages in the virtual address space.
+  static constexpr std::size_t page_count = 256;
+
+  /// The counters of a page.
+  struct Page {
+
+    /// The number of accesses that did not require writing.
+    std::uint64_t reads = 0;
+
+    /// The number of accesses that required writing.
+    std::uint64_t writes = 0;
+
+    /// The number of faults raised by accesses to the page.
+    std::uint64_t faults = 0;
+
+    /// The number of times the page has been moved out of main memory.
+    std::uint64_t evictions = 0;
+
+    /// The time of the last access, or 0 if the page has not been accessed.
+    std::uint64_t last_touch = 0;
+
+    /// Returns the number of accesses to the page.
+    inline std::uint64_t accesses() const {
+      return reads + writes;
+    }
+
+  };
+
+  /// The counters of each page.
+  std::array<Page, page_count> pages = {};
+
+  /// The page last accessed through each frame.
+  std::array<std::uint8_t, 16> frame_pages = {};
+
+  /// The number of accesses recorded so far.
+  std::uint64_t clock = 0;
+
+  /// The age below which a page is hot, in accesses.
+  std::uint64_t hot_age = 16;
+
+  /// The age from which a page is cold, in accesses.
+  std::uint64_t cold_age = 256;
+
+  /// The number of accesses between two calls to `observer`, or 0 if it is never called.
+  std::uint64_t interval = 0;
+
+  /// A function called every `interval` accesses.
+  std::function<void(PageHeatmap const&)> observer;
+
+  /// Records an access to `page` through `frame`, requiring writing iff `write` is `true`.
+  inline void record_access(std::uint8_t page, std::uint8_t frame, bool write) {
+    auto& p = pages[page];
+    (write ? p.writes : p.reads)++;
+    p.last_touch = ++clock;
+    frame_pages[frame] = page;
+    if ((interval != 0) && (clock % interval == 0) && observer) { observer(*this); }
+  }
+
+  /// Records a fault raised by an access to `page`.
+  inline void record_fault(std::uint8_t page) {
+    pages[page].faults++;
+  }
+
+  /// Records that the page stored in `frame` has been moved out of main memory.
+  inline void record_eviction(std::uint8_t frame) {
+    pages[frame_pages[frame]].evictions++;
+  }
+
+  /// Records that the page stored in frame `from` has been moved to frame `to`.
+  inline void record_migration(std::uint8_t from, std::uint8_t to) {
+    frame_pages[to] = frame_pages[from];
+  }
+
+  /// Returns the number of accesses since the last access to `page`, or `clock` if the page has
+  /// not been accessed.
+  inline std::uint64_t age(std::uint8_t page) const {
+    return clock - pages[page].last_touch;
+  }
+
+  /// Returns the temperature of `page`.
+  Temperature classify(std::uint8_t page) const {
+    if (pages[page].last_touch == 0) { return Temperature::cold; }
+    auto const a = age(page);
+    if (a < hot_age) { return Temperature::hot; }
+    return (a < cold_age) ? Temperature::warm : Temperature::cold;
+  }
+
+  /// Clears the counters, keeping the time of the last access to each page so that pages keep
+  /// their temperature across intervals.
+  void reset_counters() {
+    for (auto& p : pages) { p = {0, 0, 0, 0, p.last_touch}; }
+  }
+
+  /// Writes the counters of the pages that have been accessed or evicted to `o`, in CSV format.
+  ///
+  /// The format state of `o` is restored before the method returns.
+  void write_csv(std::ostream& o) const {
+    static constexpr char const* names[] = {"cold", "warm", "hot"};
+    auto const flags = o.flags(std::ios::dec);
+    o << "page,reads,writes,faults,evictions,age,temperature\n";
+    for (std::size_t i = 0; i < page_count; ++i) {
+      auto const& p = pages[i];
+      if ((p.accesses() == 0) && (p.evictions == 0) && (p.last_touch == 0)) { continue; }
+      auto const page = static_cast<std::uint8_t>(i);
+      write_address(o, static_cast<std::uint16_t>(i << 8))
+        << ',' << p.reads << ',' << p.writes << ',' << p.faults << ',' << p.evictions
+        << ',' << age(page) << ',' << names[static_cast<std::size_t>(classify(page))] << '\n';
+    }
+    o.flags(flags);
+  }
+
+  /// Writes the number of accesses to each page to `o`, as a grid of 16 rows of 16 pages in which
+  /// darker characters denote more accesses, relative to the most accessed page.
+  void write_grid(std::ostream& o) const {
+    static constexpr char shades[] = " .:-=+*#%@";
+    std::uint64_t most = 0;
+    for (auto const& p : pages) { most = std::max(most, p.accesses()); }
+
+    for (std::size_t row = 0; row < 16; ++row) {
+      write_address(o, static_cast<std::uint16_t>(row << 12)) << ' ';
+      for (std::size_t column = 0; column < 16; ++column) {
+        auto const n = pages[(row << 4) | column].accesses();
+        auto const s = (n == 0) ? 0 : 1 + n * (sizeof(shades) - 3) / most;
+        o << shades[s];
+      }
+      o << '\n';
+    }
+  }
+
+};
+
+} // namespace mmu
@@ -0,0 +1,464 @@
+#pragma once
+
+#include "mmu.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace mmu {
+
+/// An error indicating that the state of a machine is inconsistent.
+struct InvariantViolation final : public std::exception {
+
+  /// A description of the violation.
+  const std::string description;
+
+  /// Creates an instance with the given description.
+  InvariantViolation(std::string description) : description(std::move(description)) {}
+
+  /// Returns a textual description of this error as a null-terminated string.
+  const char* what() const noexcept override {
+    return description.c_str();
+  }
+
+};
+
+/// Calls `action(va, pda, level)` for each entry of the translation table of `m` that encodes a
+/// page entry, where `va` is the first address of the region mapped by that entry, `pda` is a
+/// pointer to its raw value, and `level` is the level of the table at which it is stored.
+template<typename F>
+void for_each_page_entry(Machine& m, F&& action) {
+  auto* page_map = m.page_map();
+  for (std::uint16_t i = 0; i < 4; ++i) {
+    auto const a0 = static_cast<std::uint16_t>(i << 14);
+    if (page_map[i] == 0) { continue; }
+    if (page_map[i] & 1) { action(VirtualAddress{a0}, page_map + i, 0); continue; }
+
+    auto* d1 = rebind<std::uint16_t>(m.main_memory + page_map[i]);
+    for (std::uint16_t j = 0; j < 8; ++j) {
+      auto const a1 = static_cast<std::uint16_t>(a0 | (j << Machine::shifts[0]));
+      if (d1[j] == 0) { continue; }
+      if (d1[j] & 1) { action(VirtualAddress{a1}, d1 + j, 1); continue; }
+
+      auto* d2 = rebind<std::uint16_t>(m.main_memory + d1[j]);
+      for (std::uint16_t k = 0; k < 8; ++k) {
+        auto const a2 = static_cast<std::uint16_t>(a1 | (k << Machine::shifts[1]));
+        if (d2[k] != 0) { action(VirtualAddress{a2}, d2 + k, 2); }
+      }
+    }
+  }
+}
+
+/// Throws an `InvariantViolation` if the state of `m` is inconsistent.
+///
+/// The following properties are checked:
+/// - the kernel break is 16-byte aligned and lies in the kernel's heap, whose frames are pinned;
+/// - every directory lies in the kernel's heap and is not in the free list;
+/// - every present page entry refers to a used frame whose descriptor refers back to it;
+/// - every large page is stored in 8 pinned frames, which are the only pinned frames outside of
+///   the kernel's heap;
+/// - every page entry that is not present refers to an allocated slot of a swap device or, if
+///   it is backed by a file, to a page of the page cache, unless it is a guard page;
+/// - no slot of secondary memory is allocated both by a swap device and by the default region;
+/// - every page that is not mapped has the protection key 0;
+/// - every write-protected page is mapped without the write permission;
+/// - every entry of the shadow table refers to the entry of its page;
+/// - every frame storing a page of a file is the frame of that page in the page cache;
+/// - every back reference of a frame refers to a present page entry mapping that frame;
+/// - every frame marked free in `free_map` is neither pinned nor referred to;
+/// - every removed frame is outside of the kernel's heap, pinned, and not referred to;
+/// - every entry of the TLB is a present page entry equal to the one stored in the table, and
+///   empty entries only occur at the end of the TLB.
+inline void check_invariants(Machine& m) {
+  auto const fail = [&](auto&&... parts) {
+    std::ostringstream o;
+    o << std::hex << std::showbase;
+    (o << ... << parts);
+    throw InvariantViolation(o.str());
+  };
+
+  auto const heap_start = static_cast<std::uint16_t>(m.page_map()[3]);
+  auto const heap_end = m.kbrk();
+  auto const limit = m.klimit();
+  if (((limit & 0xff) != 0) || (limit > (Machine::max_kernel_frames << 8))) {
+    fail("kernel heap limit out of bounds: ", limit);
+  }
+  if (((heap_end & 15) != 0) || (heap_end > limit) || (heap_end <= heap_start)) {
+    fail("kernel break out of bounds: ", heap_end);
+  }
+  for (std::uint16_t f = 0; f < 16; ++f) {
+    auto const kernel = f < (limit >> 8);
+    if (kernel && !m.frame_table()[f].is_pinned()) { fail("frame ", f, " is not pinned"); }
+    if (kernel && (m.free_map() & (1 << f))) { fail("kernel frame ", f, " is marked free"); }
+  }
+
+  // Check the free list of the kernel's heap.
+  std::vector<std::uint16_t> free_blocks;
+  for (auto b = m.kfree_list(); b != 0; b = *rebind<std::uint16_t>(m.main_memory + b)) {
+    if (((b & 15) != 0) || (b < heap_start) || (b >= heap_end)) {
+      fail("free block ", b, " out of bounds");
+    }
+    if (free_blocks.size() > (heap_end >> 4)) { fail("kernel free list is cyclic"); }
+    free_blocks.push_back(b);
+  }
+
+  // Check the directories.
+  auto const is_directory = [&](std::uint16_t d) {
+    return ((d & 15) == 0) && (d >= heap_start) && (d < heap_end)
+      && (std::find(free_blocks.begin(), free_blocks.end(), d) == free_blocks.end());
+  };
+  for (std::uint16_t i = 0; i < 4; ++i) {
+    auto const d = m.page_map()[i];
+    if ((d == 0) || (d & 1)) { continue; }
+    if (!is_directory(d)) { fail("L0 entry ", i, " refers to ", d); }
+
+    auto* d1 = rebind<std::uint16_t>(m.main_memory + d);
+    for (std::uint16_t j = 0; j < 8; ++j) {
+      if ((d1[j] != 0) && !(d1[j] & 1) && !is_directory(d1[j])) {
+        fail("L1 entry ", i, ".", j, " refers to ", d1[j]);
+      }
+    }
+  }
+
+  // The devices and the default region of secondary memory both allocate slots from slot 1, so
+  // they cannot be used together without allocating some slots twice.
+  auto* next_region = rebind<Machine::RegionPointer>(m.secondary_memory);
+  if (m.swap_devices.is_enabled() && (next_region->offset() != 1)) {
+    fail("slots 1 to ", next_region->offset() - 1, " are allocated by the region and devices");
+  }
+
+  // Count the present page entries mapping each frame.
+  auto const free_map = m.free_map();
+  std::array<std::size_t, 16> mappings = {};
+  std::vector<std::uint16_t> large_pages;
+  std::uint16_t large_frames = 0;
+
+  for_each_page_entry(m, [&](VirtualAddress va, std::uint16_t* pda, std::size_t level) {
+    auto const& pte = *rebind<PageEntry>(pda);
+    auto const large = Machine::is_large_page_level(va, level);
+    if (large) {
+      large_pages.push_back(m.pte_offset(&pte));
+      if (!pte.is_present() || pte.is_file_backed()) { fail(va.raw, ": invalid large page"); }
+    }
+
+    if (pte.is_present()) {
+      for (std::size_t k = 0; k < (large ? 8 : 1); ++k) {
+        auto const f = pte.frame() + k;
+        if (f >= 16) { fail(va.raw, ": frame ", f, " out of bounds"); }
+        if (free_map & (1 << f)) { fail(va.raw, ": frame ", f, " is marked free"); }
+        if (pte.is_file_backed() != (m.frame_table()[f].permanent_position() != 0)) {
+          fail(va.raw, ": frame ", f, " disagrees on the file backing of the page");
+        }
+        mappings[f]++;
+
+        auto const& frame = m.frame_table()[f];
+        if (large) {
+          if (!frame.is_pinned()) { fail(va.raw, ": frame ", f, " of a large page is not pinned"); }
+          large_frames |= static_cast<std::uint16_t>(1 << f);
+        }
+        auto const n = std::min<std::size_t>(frame.back_reference_count(), 2);
+        bool found = false;
+        for (std::size_t i = 0; i < n; ++i) {
+          found |= frame.back_reference(i) == m.pte_offset(&pte);
+        }
+        if (!found) {
+          fail(va.raw, ": frame ", f, " has no back reference to ", int(m.pte_offset(&pte)));
+        }
+      }
+    } else if (pte.is_guard()) {
+      // Guard pages refer to nothing.
+    } else if (pte.is_file_backed()) {
+      auto const id = pte.frame();
+      if ((id == 0) || (id > m.page_cache.size())) {
+        fail(va.raw, ": page ", id, " is not in the page cache");
+      }
+    } else {
+      auto const slot = pte.frame();
+      auto const* device = m.swap_devices.device_of(slot);
+      auto const allocated = m.swap_devices.is_enabled()
+        ? ((device != nullptr) && device->is_allocated(slot))
+        : ((slot != 0) && (slot < next_region->offset()));
+      if (!allocated) {
+        fail(va.raw, ": secondary slot ", slot, " is not allocated");
+      }
+    }
+  });
+
+  // Check the frame table.
+  for (std::uint16_t f = 0; f < 16; ++f) {
+    auto const& frame = m.frame_table()[f];
+    auto const n = frame.back_reference_count();
+
+    if (free_map & (1 << f)) {
+      if (frame.is_pinned() || (n != 0)) { fail("frame ", f, " is free but used"); }
+      continue;
+    }
+
+    if (m.removed_frames & (1 << f)) {
+      auto const in_kernel = f < Machine::max_kernel_frames;
+      if (!frame.is_pinned() || (n != 0) || (mappings[f] != 0) || in_kernel) {
+        fail("frame ", f, " is removed but used");
+      }
+      continue;
+    }
+
+    if (auto const id = frame.permanent_position(); id != 0) {
+      if ((id > m.page_cache.size()) || (m.page_cache[id - 1].frame != f)) {
+        fail("frame ", f, " stores page ", id, " which is not cached there");
+      }
+    }
+
+    if (frame.is_pinned() && (f >= (limit >> 8)) && !(large_frames & (1 << f))) {
+      fail("frame ", f, " is wrongly pinned");
+    }
+    if (n > 2) { fail("frame ", f, " has too many back references"); }
+    if (n != mappings[f]) {
+      fail("frame ", f, " has ", int(n), " back references but ", mappings[f], " mappings");
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+      auto const offset = frame.back_reference(i);
+      auto const& pte = *rebind<PageEntry>(m.main_memory + offset);
+      auto const large = std::ranges::find(large_pages, offset) != large_pages.end();
+      auto const mapped = large
+        ? ((f >= pte.frame()) && (f < pte.frame() + 8))
+        : (pte.frame() == f);
+      if (!pte.is_present() || !mapped) {
+        fail("frame ", f, " has a stale back reference");
+      }
+    }
+  }
+
+  // Check the protection keys and the write-protected pages.
+  for (std::uint16_t p = 0; p < 256; ++p) {
+    auto const* pte = m.lookup_entry(static_cast<std::uint16_t>(p << 8));
+    if ((m.page_keys[p] != 0) && (pte == nullptr)) {
+      fail("unmapped page ", p << 8, " has protection key ", int(m.page_keys[p]));
+    }
+    if (m.write_protected[p] && ((pte == nullptr) || (pte->protection() & PageEntry::write))) {
+      fail("page ", p << 8, " is not write-protected");
+    }
+
+    auto const shadow = m.shadow.entries[p];
+    auto const large = m.find_large_page(static_cast<std::uint16_t>(p << 8));
+    if ((shadow != 0) && ((pte == nullptr) || (m.pte_offset(pte) != (shadow & ~1))
+      || (((shadow & 1) != 0) != (large != nullptr))))
+    {
+      fail("shadow entry of page ", p << 8, " is stale");
+    }
+  }
+
+  // Check the page cache.
+  for (std::size_t i = 0; i < m.page_cache.size(); ++i) {
+    auto const f = m.page_cache[i].frame;
+    if ((f != 0xff) && ((f >= 16) || (m.frame_table()[f].permanent_position() != i + 1))) {
+      fail("page ", i + 1, " is not stored in frame ", int(f));
+    }
+  }
+
+  // Check the TLB.
+  auto const& tlb = m.tlb;
+  bool end = false;
+  for (std::size_t i = 0; i < Machine::tlb_size; ++i) {
+    auto const p = tlb[i];
+    auto const va = VirtualAddress{p.key};
+    auto const cached = PageEntry::from_raw(p.value);
+
+    if ((p.key == 0) && (p.value == 0)) { end = true; continue; }
+    if (end) { fail("TLB entry ", i, " follows an empty entry"); }
+    if (va.page().raw != va.raw) { fail("TLB entry ", i, " is not page-aligned"); }
+
+    // The TLB caches the entry of each page of a large page separately.
+    auto* pte = m.lookup_entry(va);
+    auto expected = (pte != nullptr) ? *pte : PageEntry{};
+    if ((pte != nullptr) && (m.find_large_page(va) == pte)) {
+      expected.set_frame(pte->frame() + ((va.raw >> Machine::shifts[1]) & 0x7));
+    }
+    if ((pte == nullptr) || (expected.raw != cached.raw) || !cached.is_present()) {
+      fail("TLB entry ", i, " for ", va.raw, " is stale");
+    }
+  }
+}
+
+/// A trivially correct model of the virtual memory of a machine.
+///
+/// The model stores the protection and the contents of each mapped page in host memory.
+struct ReferenceMemory {
+
+  /// A mapped page.
+  struct Page {
+
+    /// The protection of the page.
+    PageEntry::Protection protection;
+
+    /// The contents of the page.
+    std::array<std::byte, 256> contents = {};
+
+  };
+
+  /// A map from page-aligned address to page.
+  std::map<std::uint16_t, Page> pages;
+
+  /// Returns the page containing `va`, if any.
+  inline Page* page(VirtualAddress va) {
+    auto p = pages.find(va.page().raw);
+    return (p != pages.end()) ? &p->second : nullptr;
+  }
+
+};
+
+/// A driver applying the same operations to a machine and to a reference model of its memory,
+/// checking that both agree and that the invariants of the machine hold after each operation.
+///
+/// Operations are decoded from a sequence of bytes so that the driver can be used either with a
+/// pseudo-random generator or with a coverage-guided fuzzer.
+struct DifferentialDriver {
+
+  /// The machine under test.
+  ///
+  /// The compressed pool of the machine is enabled so that swapping goes through both tiers, and
+  /// so are background reclaim, the TLB prefetcher, and the shadow table.
+  Machine machine;
+
+  /// The reference model of the memory of `machine`.
+  ReferenceMemory reference;
+
+  /// The number of operations executed so far.
+  std::size_t operation_count = 0;
+
+  /// Creates an instance.
+  DifferentialDriver() {
+    machine.compressed_pool = CompressedPool(1024);
+    machine.watermarks = {.low = 1, .high = 2};
+    machine.tlb_prefetcher.depth = 2;
+    machine.shadow.enabled = true;
+  }
+
+  /// Throws an `InvariantViolation` describing a disagreement with the reference model.
+  [[noreturn]] void diverge(char const* operation, VirtualAddress va) {
+    std::ostringstream o;
+    o << "operation " << operation_count << " (" << operation << " at " << std::hex << std::showbase
+      << va.raw << ") diverged";
+    throw InvariantViolation(o.str());
+  }
+
+  /// Maps `length` bytes with `protection`.
+  void mmap(VirtualAddress hint, std::size_t length, PageEntry::Protection protection) {
+    VirtualAddress va = 0;
+    try {
+      va = machine.simple_mmap(hint, length, protection);
+    } catch (std::bad_alloc const&) {
+      return;
+    }
+
+    if ((va.page().raw != va.raw) || (va.raw < 0x0100)) { diverge("mmap", va); }
+    for (std::size_t i = 0; i < ((length + 255) >> 8); ++i) {
+      auto const a = static_cast<std::uint16_t>(va.raw + (i << 8));
+      if ((a >= 0xf800) || !reference.pages.try_emplace(a, protection).second) {
+        diverge("mmap", va);
+      }
+    }
+  }
+
+  /// Unmaps `length` bytes from the page-aligned address `va`.
+  void munmap(VirtualAddress va, std::size_t length) {
+    machine.simple_munmap(va, length);
+    for (std::size_t i = 0; i < length; i += 256) {
+      reference.pages.erase(static_cast<std::uint16_t>(va.raw + i));
+    }
+  }
+
+  /// Translates `va` with `permissions`, checking the outcome against the reference model.
+  ///
+  /// The return value is the physical address of `va` or `std::nullopt` if translation failed.
+  std::optional<PhysicalAddress> translate(
+    VirtualAddress va, PageEntry::Protection permissions
+  ) {
+    auto const* p = reference.page(va);
+    try {
+      auto const pa = machine.translate(va, permissions);
+      if (!p || (va.raw == 0) || ((p->protection & permissions) != permissions)) {
+        diverge("translate", va);
+      }
+      return pa;
+    } catch (PageLookupError const& e) {
+      auto const expected = (!p || (va.raw == 0)) ? SegmentationFault : PermissionFault;
+      if (p && (va.raw != 0) && ((p->protection & permissions) == permissions)) {
+        diverge("translate", va);
+      }
+      if (e.cause != expected) { diverge("translate", va); }
+      return std::nullopt;
+    }
+  }
+
+  /// Stores `b` at `va`.
+  void store(VirtualAddress va, std::byte b) {
+    if (auto const pa = translate(va, PageEntry::write)) {
+      machine.store_byte(b, *pa);
+      reference.page(va)->contents[va.raw & 0xff] = b;
+    }
+  }
+
+  /// Loads the byte at `va`.
+  void load(VirtualAddress va) {
+    if (auto const pa = translate(va, PageEntry::read)) {
+      if (machine.read_byte(*pa) != reference.page(va)->contents[va.raw & 0xff]) {
+        diverge("load", va);
+      }
+    }
+  }
+
+  /// Returns an address decoded from `hi` and `lo`, which is biased toward mapped pages.
+  ///
+  /// The address is always below the kernel's address space, which the model does not describe.
+  VirtualAddress address(std::uint8_t hi, std::uint8_t lo) const {
+    if ((hi & 1) || reference.pages.empty()) {
+      return static_cast<std::uint16_t>(((hi << 8) | lo) % 0xf800);
+    }
+    auto p = reference.pages.begin();
+    std::advance(p, (hi >> 1) % reference.pages.size());
+    return static_cast<std::uint16_t>(p->first | lo);
+  }
+
+  /// Executes the operations encoded in `input`.
+  ///
+  /// Each operation is encoded by 4 bytes `(o, a, b, c)`. The 4 lowest bits of `o` identify the
+  /// operation and its 3 next bits denote protection flags; the other bytes are its arguments.
+  /// Mappings are rarer than accesses and their hints are concentrated in a few directories so
+  /// that long sequences can run before the kernel runs out of memory.
+  void run(std::span<std::uint8_t const> input) {
+    for (std::size_t i = 0; i + 4 <= input.size(); i += 4) {
+      auto const o = input[i], a = input[i + 1], b = input[i + 2], c = input[i + 3];
+      auto const protection = static_cast<PageEntry::Protection>((o >> 4) & 7);
+      auto const k = o & 15;
+
+      if (k == 0) {
+        auto const hint = static_cast<std::uint16_t>((a & 0x80) ? 0 : 0x1000 + ((a & 0x1f) << 8));
+        auto const length = static_cast<std::size_t>(b % 4) * 256 + c + 1;
+        mmap(hint, length, protection);
+      } else if (k == 1) {
+        auto const va = address(a, 0).page();
+        auto const length = std::min<std::size_t>((b % 4 + 1) << 8, 0xf800 - va.raw);
+        munmap(va, length);
+      } else if (k < 7) {
+        store(address(a, b), std::byte{c});
+      } else if (k < 13) {
+        load(address(a, b));
+      } else {
+        translate(address(a, b), protection);
+      }
+
+      operation_count++;
+      check_invariants(machine);
+    }
+  }
+
+};
+
+} // namespace mmu
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mmu {
+
+/// An event contributing to the latency of a memory access.
+enum class Event : std::uint8_t {
+
+  /// A lookup in the TLB, whether it hits or misses.
+  tlb_lookup,
+
+  /// A read of a directory entry during a page walk.
+  walk_step,
+
+  /// An access to the first level of the data cache (see `CacheHierarchy`).
+  l1_access,
+
+  /// An access to the second level of the data cache.
+  l2_access,
+
+  /// An access to main memory.
+  memory_access,
+
+  /// The additional cost of an access to main memory on another NUMA node than the one of the
+  /// core issuing the access (see `FrameAllocationPolicy`).
+  remote_memory_access,
+
+  /// A trap to the kernel, caused by an unmapped page or by a page that is not present.
+  fault,
+
+  /// A page read from the compressed pool (see `CompressedPool`).
+  pool_read,
+
+  /// A page written to the compressed pool.
+  pool_write,
+
+  /// A page read from secondary memory.
+  swap_read,
+
+  /// A page written to secondary memory.
+  swap_write,
+
+  /// A page read from a file (see `Machine::mmap_file`).
+  file_read,
+
+  /// A page written back to a file.
+  file_write,
+
+};
+
+/// The number of cases in `Event`.
+inline constexpr std::size_t event_count = 13;
+
+/// The name of each case in `Event`, indexed by `Event`.
+inline constexpr std::array<char const*, event_count> event_names = {
+  "tlb_lookup", "walk_step", "l1_access", "l2_access", "memory_access", "remote_memory_access",
+  "fault", "pool_read", "pool_write", "swap_read", "swap_write", "file_read", "file_write",
+};
+
+/// The cost of each event contributing to the latency of memory accesses, in cycles.
+///
+/// The default costs are orders of magnitude typical of a desktop machine with a solid-state
+/// drive as secondary memory. They are meant to be tuned to the system being modeled.
+struct CostModel {
+
+  /// The cost of each event, indexed by `Event`.
+  std::array<std::uint64_t, event_count> cycles = {
+    1,        // tlb_lookup
+    30,       // walk_step
+    4,        // l1_access
+    12,       // l2_access
+    100,      // memory_access
+    60,       // remote_memory_access
+    1000,     // fault
+    3000,     // pool_read
+    6000,     // pool_write
+    100000,   // swap_read
+    100000,   // swap_write
+    100000,   // file_read
+    100000,   // file_write
+  };
+
+  /// Returns the cost of `e`.
+  inline std::uint64_t operator[](Event e) const {
+    return cycles[static_cast<std::size_t>(e)];
+  }
+
+  /// Returns a reference to the cost of `e`.
+  inline std::uint64_t& operator[](Event e) {
+    return cycles[static_cast<std::size_t>(e)];
+  }
+
+};
+
+/// The latency of the memory accesses of a machine, accumulated per core.
+///
+/// An access starts with a call to `begin` and accumulates the cost of each event `charge`d until
+/// the next access starts. The average memory access time (AMAT) of a core is the total cost of
+/// its accesses divided by their number.
+struct LatencyStatistics {
+
+  /// The latency of the accesses issued by a core.
+  struct Core {
+
+    /// The number of accesses.
+    std::uint64_t accesses = 0;
+
+    /// The total cost of the accesses, in cycles.
+    std::uint64_t cycles = 0;
+
+    /// The number of occurrences of each event, indexed by `Event`.
+    std::array<std::uint64_t, event_count> events = {};
+
+    /// Returns the average memory access time, in cycles.
+    inline double amat() const {
+      return (accesses == 0) ? 0.0 : static_cast<double>(cycles) / accesses;
+    }
+
+    /// Returns the number of occurrences of `e`.
+    inline std::uint64_t count(Event e) const {
+      return events[static_cast<std::size_t>(e)];
+    }
+
+  };
+
+  /// The statistics of each core.
+  std::vector<Core> cores = std::vector<Core>(1);
+
+  /// The core issuing the current access.
+  std::size_t core = 0;
+
+  /// The cost of the current access, in cycles.
+  std::uint64_t last_access = 0;
+
+  /// Starts an access issued by core `c`.
+  void begin(std::size_t c) {
+    if (c >= cores.size()) { cores.resize(c + 1); }
+    core = c;
+    last_access = 0;
+    cores[c].accesses++;
+  }
+
+  /// Adds the cost of `e` to the current access.
+  inline void charge(Event e, CostModel const& model) {
+    charge(e, model[e]);
+  }
+
+  /// Adds an occurrence of `e` costing `c` cycles to the current access.
+  void charge(Event e, std::uint64_t c) {
+    last_access += c;
+    cores[core].cycles += c;
+    cores[core].events[static_cast<std::size_t>(e)]++;
+  }
+
+  /// Returns the statistics of all cores combined.
+  Core total() const {
+    Core result;
+    for (auto const& c : cores) {
+      result.accesses += c.accesses;
+      result.cycles += c.cycles;
+      for (std::size_t i = 0; i < event_count; ++i) { result.events[i] += c.events[i]; }
+    }
+    return result;
+  }
+
+};
+
+} // namespace mmu
@@ -1,12 +1,32 @@
 #pragma once
 
+#include "address.hh"
+#include "cache.hh"
+#include "heatmap.hh"
+#include "latency.hh"
+#include "placement.hh"
+#include "prefetch.hh"
+#include "swap.hh"
+#include "zswap.hh"
+
 #include <algorithm>
+#include <array>
 #include <bit>
+#include <bitset>
 #include <cassert>
 #include <cstdint>
 #include <exception>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace mmu {
 
@@ -33,15 +53,7 @@ inline constexpr T const* rebind(void const* p) { return static_cast<T const*>(p
 
 
 //////////////////////////////////////////// ADDRESSES ////////////////////////////////////////////
-/// Writes a textual representation of `a`, which is an address, to `o`.
-std::ostream& write_address(std::ostream& o, std::uint16_t a) {
-  std::ios cout_state(nullptr);
-  cout_state.copyfmt(std::cout);
-  std::cout << "0x";
-  std::cout << std::hex << std::setw(4) << std::setfill('0') << a;
-  std::cout.copyfmt(cout_state);
-  return o;
-}
+// The textual representation of addresses (`format_address`, `write_address`) is in `address.hh`.
 //////////////////////////////////////////// VIRTUAL ADDRESS ////////////////////////////////////////////
 /// An index in a page translation table together with an offset in a physical frame.
 ///
@@ -64,7 +76,8 @@ struct VirtualAddress {
   /// The raw value of this address.
   std::uint16_t raw;
 
-  VirtualAddress(std::uint16_t raw) : raw(raw) {};
+  /// Creates an instance with the given raw value.
+  constexpr VirtualAddress(std::uint16_t raw) : raw(raw) {};
 
   /// Returns the address of the page containing this address.
   inline constexpr VirtualAddress page() const {
@@ -113,22 +126,30 @@ enum PageLookupErrorCause : std::uint8_t {
   SegmentationFault = 2,
 
   /// The protection of the page does not allow the requested action.
-  PermissionFault = 4
+  PermissionFault = 4,
+
+  /// The page is a guard page (see `Machine::simple_mmap`).
+  GuardFault = 8,
+
+  /// The rights of the current core on the protection key of the page do not allow the requested
+  /// action (see `Machine::pkey_set`).
+  ProtectionKeyFault = 16
 
 };
 
-/// An error indicating that page lookup failed.
-struct PageLookupError final : public std::exception {
+/// An error indicating that page lookup failed for an address of type `Address`.
+template<typename Address>
+struct BasicPageLookupError final : public std::exception {
 
   /// The address that was looked up.
-  const VirtualAddress target;
+  const Address target;
 
   /// The reason for this error.
   const PageLookupErrorCause cause;
 
   /// Creates an instance describing that `cause` occurred while looking up `target`.
-  constexpr PageLookupError(
-    VirtualAddress target, PageLookupErrorCause cause
+  BasicPageLookupError(
+    Address target, PageLookupErrorCause cause
   ) : target(target), cause(cause) {}
 
   /// Returns a textual description of this error as a null-terminated string.
@@ -140,10 +161,18 @@ struct PageLookupError final : public std::exception {
         return "segmentation fault";
       case PermissionFault:
         return "permission fault";
+      case GuardFault:
+        return "guard page fault";
+      case ProtectionKeyFault:
+        return "protection key fault";
     }
+    return "page lookup error";
   }
 
 };
+
+/// An error indicating that page lookup failed.
+using PageLookupError = BasicPageLookupError<VirtualAddress>;
 //////////////////////////////////////////// END ERROR HANDLING ////////////////////////////////////////////
 
 
@@ -160,30 +189,36 @@ struct PageLookupError final : public std::exception {
 /// - `br` is a sequence of "back" references to PTEs referring to `f`, and
 /// - `pp` optionally identifies the permanent position of `f` in secondary memory.
 ///
+/// The permanent position of a frame storing a page of a file is the identifier of that page in
+/// the page cache (see `Machine::page_cache`). Such a frame is written back to its file rather than
+/// swapped out when it is evicted, and it remains in the cache when its last mapping is removed.
+///
 /// These components are represented as an array of four 8-bit unsigned integers:
 ///
 ///     ┌────────╥───┬───┬───┬───┬───┬───┬───┬───┐
 ///     │        ║ 7 │ 6 │ 5 │ 4 │ 3 │ 2 │ 1 │ 0 │
 ///     ╞════════╬═══╧═══╪═══╪═══╪═══╧═══╪═══╪═══╡
-///     │ raw[0] ║ pp hi │ - │ - │ brcnt │ p │ r │
+///     │ raw[0] ║ pp hi │b1h│b0h│ brcnt │ p │ r │
 ///     ├────────╫───────┴───┴───┴───────┴───┴───┤
 ///     │ raw[1] ║ pp lo                         │
 ///     ├────────╫───────────────────────────────┤
-///     │ raw[2] ║ backref 0                     │
+///     │ raw[2] ║ backref 0 lo                  │
 ///     ├────────╫───────────────────────────────┤
-///     │ raw[3] ║ backref 1                     │
+///     │ raw[3] ║ backref 1 lo                  │
 ///     └────────╨───────────────────────────────┘
 ///
-/// Note that bits 4 and 5 are currently reserved.
-///
 /// The permenent position identifier (`pp`) is represented as a 10-bit unsigned integer. Its two
 /// highest bits are stored in `raw[0]` whereas the other bits are stored in `raw[1]`.
 ///
 /// The sequence of back references `br` is used to update the page translation table when a frame
 /// is swapped out. This feature is only partially implemented. Currently, if there are less than
-/// three references, then `brcnt` contains the length of the sequence, which is stored in `raw[2]`
-/// and `raw[3]` as an array of offsets in physical memory. Otherwise, `brcnt` is equal to 3 and
-/// the contents of `raw[2]` and `raw[3]` is unspecified.
+/// three references, then `brcnt` contains the length of the sequence. Otherwise, `brcnt` is equal
+/// to 3 and the back references are unspecified.
+///
+/// A back reference is the offset of a PTE in physical memory. Since PTEs are 2-byte aligned, it
+/// is stored in 2-byte units as a 9-bit unsigned integer whose highest bit is stored in `raw[0]`
+/// (`b0h` or `b1h`) and whose other bits are stored in `raw[2]` or `raw[3]`. Hence, PTEs must be
+/// stored in the first 1KB of main memory (see `Machine::kalloc`).
 ///
 /// When a page not currently in *main memory* is accessed (or allocated), the system must first map
 /// that page to some frame. If all frames are occupied, the system will try to "steal" the frame
@@ -231,18 +266,44 @@ struct FrameDescriptor {
 
   /// Returns the number of entries in the back-reference list of this frame.
   inline constexpr std::uint8_t back_reference_count() const {
-    return raw[0] >> 2;
+    return (raw[0] >> 2) & 3;
+  }
+
+  /// Returns the offset of the `i`-th page entry mapping to this frame.
+  ///
+  /// - Requires: `i` is less than `min(back_reference_count(), 2)`.
+  inline constexpr std::uint16_t back_reference(std::size_t i) const {
+    auto const hi = static_cast<std::uint16_t>((raw[0] >> (4 + i)) & 1);
+    return static_cast<std::uint16_t>(((hi << 8) | raw[i + 2]) << 1);
   }
 
+  /// Adds `entry`, which is the offset of a page entry, to the back references of this frame.
+  ///
   /// A list of length greater than 2 is considered to have an arbitrary length.
-  /// We store the offset of the page entry.
-  void add_back_reference(std::uint8_t entry) {
+  void add_back_reference(std::uint16_t entry) {
+    assert(((entry & 1) == 0) && (entry < 0x400));
     auto c = back_reference_count();
     if (c < 2) {
-      raw[c + 2] = entry;
+      raw[c + 2] = static_cast<std::uint8_t>(entry >> 1);
+      raw[0] = (raw[0] & ~(0x10 << c)) | (((entry >> 9) & 1) << (4 + c));
     }
     if (c < 3) {
-      raw[0] = (raw[0] & 0xc3) | ((c + 1) << 2);
+      raw[0] = (raw[0] & ~0x0c) | ((c + 1) << 2);
+    }
+  }
+
+  /// Removes `entry`, which is the offset of a page entry, from the back references of this frame.
+  ///
+  /// - Requires: the back-reference list of this frame has at most 2 entries.
+  void remove_back_reference(std::uint16_t entry) {
+    auto const c = back_reference_count();
+    assert(c <= 2);
+    if ((c == 2) && (back_reference(0) == entry)) {
+      auto const other = back_reference(1);
+      clear_back_references();
+      add_back_reference(other);
+    } else if ((c > 0) && (back_reference(c - 1) == entry)) {
+      raw[0] = (raw[0] & ~0x0c) | ((c - 1) << 2);
     }
   }
 
@@ -251,20 +312,15 @@ struct FrameDescriptor {
     raw[0] = raw[0] & 0xc3;
   }
 
-  /// Returns the offsets of the pate table entries mapping to this frame.
-  inline constexpr std::uint8_t const* back_references() const {
-    return raw + 2;
-  }
-
   /// Returns the position of the frame in secondary memory if it is permanent or 0 otherwise.
   inline constexpr std::uint16_t permanent_position() const {
-    return static_cast<std::uint16_t>(raw[1]) | (static_cast<std::uint16_t>(raw[0] & 0xc0) << 8);
+    return static_cast<std::uint16_t>(raw[1]) | (static_cast<std::uint16_t>(raw[0] & 0xc0) << 2);
   }
 
-  /// Returns the position of the frame in secondary memory if it is permanent or 0 otherwise.     // I presume this is a setter and the one above is a getter.
+  /// Sets the position of the frame in secondary memory.
   inline void set_permanent_position(std::uint16_t p) {
     raw[1] = static_cast<std::uint8_t>(p & 0xff);
-    raw[0] = (raw[0] & 0x3f) | static_cast<std::uint8_t>(p >> 8);
+    raw[0] = (raw[0] & 0x3f) | static_cast<std::uint8_t>((p >> 2) & 0xc0);
   }
 
 };
@@ -277,14 +333,17 @@ struct FrameDescriptor {
 /// A page table entry (PTE) is a record describing how a page in the virtual memory space is     // Just as a reminder, pages go inside a frame.
 /// mapped to a frame in physical memory space.
 ///
-/// A PTE is represented as a 16-bit integer, using the layout below:
+/// A PTE is represented as an unsigned integer of type `Raw`, using the layout below:
 ///
 ///     ┌───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┐
 ///     │ f │ e │ d │ c │ b │ a │ 9 │ 8 │ 7 │ 6 │ 5 │ 4 │ 3 │ 2 │ 1 │ 0 │
 ///     ╞═══╧═══╧═══╧═══╧═══╧═══╧═══╧═══╧═══╧═══╪═══╪═══╪═══╪═══╪═══╪═══╡
-///     │ frame number                          │ - │ x │ w │ r │ p │ a │
+///     │ frame number                          │ f │ x │ w │ r │ p │ a │
 ///     └───────────────────────────────────────┴───┴───┴───┴───┴───┴───┘
 ///
+/// The frame number occupies all the bits above bit 5. The machine (see `Machine`) uses 16-bit
+/// entries, whereas machines with wider address spaces (see `WideMachine`) use 64-bit entries.
+///
 /// The meaning of the flags stored in the least significant bits is as follows:
 ///
 /// - `a` is set iff the page entry is defined.                                 // Does the frame already exist ?
@@ -292,16 +351,21 @@ struct FrameDescriptor {
 /// - `r` is set iff the page can be read.                                    // Perms...
 /// - `w` is set iff the page can be written to.
 /// - `x` is set iff the page can be executed.
-///
-/// Note that bit 5 is currently reserved.
+/// - `f` is set iff the page is backed by a file (see `Machine::mmap_file`).
 ///
 /// If `a` is not set, the other bits must be set to 0 and the whole representation denotes the
 /// absence of any value. This invariant can be used to represent an optional PTE without using
 /// additional storage.
 ///
 /// If `p` is set, the frame number identifies a frame in main memory. Otherwise, it identifies a
-/// frame in secondary memory that should be swapped in before it can be accessed.
-struct PageEntry {
+/// frame in secondary memory that should be swapped in before it can be accessed or, if `f` is
+/// set, a page of the page cache that should be read from its file.
+///
+/// An entry whose only set bit is `a` denotes a guard page (see `Machine::simple_mmap`), which is
+/// mapped but can never be accessed. It is unambiguous because the first slot of secondary memory
+/// never stores a page.
+template<typename Raw>
+struct BasicPageEntry {
 
   /// The raw representation of a set of protection flags.
   using Protection = std::uint8_t;
@@ -316,13 +380,13 @@ struct PageEntry {
   static constexpr Protection execute = 4;
 
   /// The raw representation of the entry.
-  std::uint16_t raw;
+  Raw raw;
 
   /// Creates a "none" value.
-  inline constexpr PageEntry() : raw(0) {}
+  inline constexpr BasicPageEntry() : raw(0) {}
 
   /// Creates an entry referring to the given frame.
-  inline constexpr PageEntry(std::uint8_t frame) : raw(0) {
+  inline constexpr BasicPageEntry(Raw frame) : raw(0) {
     set_frame(frame);
   }
 
@@ -331,6 +395,16 @@ struct PageEntry {
     return raw == 0;
   }
 
+  /// Returns `true` iff this entry denotes a guard page.
+  inline constexpr bool is_guard() const {
+    return raw == 1;
+  }
+
+  /// Returns the entry of a guard page.
+  static constexpr BasicPageEntry guard() {
+    return from_raw(1);
+  }
+
   /// Returns `true` iff the frame corresponding to this entry is present in main memory.
   inline constexpr bool is_present() const {
     return raw & 2;
@@ -338,37 +412,50 @@ struct PageEntry {
 
   /// Sets the present flag of this entry.
   inline void set_present(bool v) {
-    raw = v ? (raw | 3) : (raw & ~2);
+    raw = static_cast<Raw>(v ? (raw | 3) : (raw & ~Raw{2}));
   }
 
   /// Returns the protection flags of this frame.
   inline constexpr Protection protection() const {
-    return (raw >> 2) & 3;
+    return (raw >> 2) & 7;
   }
 
   /// Modifies the protection flags of this frame.
   inline void set_protection(Protection f) {
-    raw = 1 | (raw & ~0x1c) | (f << 2);
+    raw = static_cast<Raw>(1 | (raw & ~Raw{0x1c}) | (Raw{f} << 2));
+  }
+
+  /// Returns `true` iff the page described by this entry is backed by a file.
+  inline constexpr bool is_file_backed() const {
+    return raw & 0x20;
+  }
+
+  /// Sets the file-backed flag of this entry.
+  inline void set_file_backed(bool v) {
+    raw = static_cast<Raw>(v ? (raw | 0x21) : (raw & ~Raw{0x20}));
   }
 
   /// Returns the offset of the frame corresponding to the page described by this entry.
-  inline constexpr std::uint16_t frame() const {
-    return static_cast<std::uint8_t>(raw >> 6);
+  inline constexpr Raw frame() const {
+    return raw >> 6;
   }
 
   /// Modifies the offset of the frame corresponding to the page described by this entry.
-  inline constexpr void set_frame(std::uint16_t value) {
-    raw = 1 | (raw & 0x3f) | (value << 6);
+  inline constexpr void set_frame(Raw value) {
+    raw = static_cast<Raw>(1 | (raw & 0x3f) | (value << 6));
   }
 
   /// Creates an instance from its raw value.
-  static constexpr PageEntry from_raw(std::uint16_t raw) {
-    PageEntry self;
+  static constexpr BasicPageEntry from_raw(Raw raw) {
+    BasicPageEntry self;
     self.raw = raw;
     return self;
   }
 
 };
+
+/// Information about a page of the machine (see `Machine`).
+using PageEntry = BasicPageEntry<std::uint16_t>;
 //////////////////////////////////////////// END FRAME ////////////////////////////////////////////
 
 
@@ -378,83 +465,103 @@ struct PageEntry {
 /// A translation lookaside buffer (TLB).
 ///
 /// This data structure implements a cache backed by a simple ring buffer. Each entry in the cache
-/// is represented by a pair of 16-bit integers whose components are a 16-bit aligned address and
-/// the raw value of a page table entry (PTE), respectively.
+/// is represented by a pair whose components are the raw value of a page-aligned address, of type
+/// `Key`, and the raw value of a page table entry (PTE), of type `Value`, respectively.
 ///
 /// An empty entry is represented by a pair of zeros, relying on the fact that the null address has
 /// no translation and that the raw value of an empty PTE is zero.
-template<std::size_t size>
-struct TLB {
+template<typename Key, typename Value, std::size_t size>
+struct BasicTLB {
+
+  static_assert(std::has_single_bit(size), "the size of a TLB must be a power of 2");
+
+  /// An entry in a TLB.
+  struct Element {
+
+    /// The page-aligned address of the entry.
+    Key key;
+
+    /// The page table entry to which `key` is mapped.
+    Value value;
+
+  };
 
   /// The elements in this TLB.
-  std::uint32_t elements[size] = {0};
+  Element elements[size] = {};
 
   /// The index of the first element in this TLB.
   std::uint32_t first = 0;
 
   /// Accesses the `i-th` element of this TLB.
-  inline constexpr std::uint32_t operator[](std::size_t i) const {
+  inline constexpr Element const& operator[](std::size_t i) const {
     return elements[(first + i) & (size - 1)];
   }
 
   /// Accesses the `i-th` element of this TLB.
-  inline constexpr std::uint32_t& operator[](std::size_t i) {
-    return elements[(first + i) % size];
+  inline constexpr Element& operator[](std::size_t i) {
+    return elements[(first + i) & (size - 1)];
   }
 
   /// Inserts a record in this TLB, mapping the page-aligned address `va` to the page entry `pte`.
   ///
   /// - Requires: there is no record mapping `va` to a page entry before the method is called.
-  void insert(VirtualAddress va, PageEntry pte) {
-    first = (first - 1) % size;
-    elements[first] = (pte.raw << 16) | va.raw;
+  void insert(Key va, Value pte) {
+    first = (first - 1) & (size - 1);
+    elements[first] = {va, pte};
   }
 
   /// Returns the cached page table entry corresponding to the given page-aligned address, if any.
   ///
   /// The method returns an empty PTE (i.e., a PTE whose raw value is zero) iff the cache contains
   /// no entry mapping `va`. Otherwise, the looked-up entry is moved closer to the start.
-  PageEntry lookup(VirtualAddress va) {                                                           // This is the circular array thingy. Called a ring array.
+  Value lookup(Key va) {                                                           // This is the circular array thingy. Called a ring array.
     for (std::size_t i = 0; i < size; ++i) {
       auto const p = (*this)[i];
-      auto const k = p & 0xffff;
 
       // Did we reach the end of the buffer?
-      if (k == 0) { break; }
+      if (p.key == 0) { break; }
 
       // Is that a hit?
-      else if (va.raw == k) {
+      else if (va == p.key) {
         // Update the cache and return the decoded entity.
         if (i > 0) { std::swap((*this)[i], (*this)[i - 1]); }
-        return PageEntry::from_raw(static_cast<std::uint16_t>(p >> 16));
+        return p.value;
       }
     }
 
     // Out of luck.
-    return PageEntry{};
+    return Value{0};
+  }
+
+  /// Returns `true` iff this TLB contains a record for the page-aligned address `va`.
+  ///
+  /// Unlike `lookup`, this method does not reorder the elements of the buffer.
+  bool contains(Key va) const {
+    for (std::size_t i = 0; i < size; ++i) {
+      if ((*this)[i].key == 0) { return false; }
+      if ((*this)[i].key == va) { return true; }
+    }
+    return false;
   }
 
   /// Invalidates all enries referring to `pte`.
-  void invalidate(PageEntry pte) {
-    // Use `i` to point at the first of the entries left to process and `j` to point immediately
-    // after the last entry to process.
-    std::size_t i = 0, j = size;
-
-    // The loop maintain the invariant that all entries after `j` are 0. Termination is guaranteed
-    // by the fact that each iteration either increases `i` or decreases `j`.
-    while (i < j) {
-      if (((*this)[i] >> 16) == pte.raw) {
-        (*this)[i] = 0;
-        std::swap((*this)[i], (*this)[j - 1]);
-        j--;
-      } else {
-        i++;
-      }
+  void invalidate(Value pte) {
+    // Move the entries that do not refer to `pte` toward the start, preserving their order, so
+    // that empty entries remain at the end of the buffer (see `lookup`).
+    std::size_t j = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+      auto const p = (*this)[i];
+      if (p.value != pte) { (*this)[j++] = p; }
     }
+    for (; j < size; ++j) { (*this)[j] = {}; }
   }
 
 };
 
+/// The TLB of the machine (see `Machine`).
+template<std::size_t size>
+using TLB = BasicTLB<std::uint16_t, std::uint16_t, size>;
+
             // Above is a pretty important algorithm (swap) because it has a linear complexity of O(n).
 
 //////////////////////////////////////////// END TLB ////////////////////////////////////////////
@@ -511,6 +618,318 @@ struct Machine {
   /// where `o` is the offset to the start of the region and `l` is its length.
   std::byte* secondary_memory;
 
+  /// The devices sharing the slots of secondary memory (see `SwapDevices`).
+  ///
+  /// By default, secondary memory is a single device whose slots are allocated from the region
+  /// stored in its first slot and whose costs are given by `cost_model`. Adding devices replaces
+  /// that region, so devices must be added with `add_swap_device`, which fails once a page has
+  /// been swapped out to the region.
+  SwapDevices swap_devices;
+
+  /// The compressed tier between main memory and secondary memory (see `CompressedPool`).
+  ///
+  /// The pool is disabled by default. It is enabled by assigning it a capacity.
+  CompressedPool compressed_pool;
+
+  /// The cost of the events contributing to the latency of memory accesses.
+  CostModel cost_model;
+
+  /// The latency of the memory accesses issued so far.
+  ///
+  /// Every translation counts as one access, including the ones made by the kernel to allocate
+  /// pages (e.g., in `simple_mmap`).
+  LatencyStatistics latency;
+
+  /// The data caches between the CPU and main memory.
+  ///
+  /// The caches are disabled by default, in which case each translation is charged a single
+  /// access to main memory. Otherwise, the latency of an access depends on the levels it reaches
+  /// when the translated address is read or written (see `read_byte` and `store_byte`). Caches
+  /// are physically indexed and only model timing: the data always resides in `main_memory`.
+  CacheHierarchy caches;
+
+  /// The policy choosing among free frames when a page is brought into main memory.
+  FrameAllocationPolicy frame_policy;
+
+  /// A host-side table caching the location of the entry of each page, so that a TLB miss can be
+  /// resolved with a single load instead of a page walk.
+  ///
+  /// The translation table in main memory remains authoritative: the shadow table only records
+  /// where the entry of a page is stored, which does not change when the page is swapped in or
+  /// out. It is filled by page walks and by `allocate_on_segfault`, and its entries are cleared
+  /// when the entries they refer to are removed or moved (see `unmap_page`,
+  /// `collapse_large_page`, and `split_large_page`).
+  struct ShadowTable {
+
+    /// `true` iff translations use the shadow table.
+    bool enabled = false;
+
+    /// The offset of the entry of each page in main memory, indexed by page number, or 0 if it is
+    /// unknown. The least significant bit is set iff the entry maps a large page.
+    std::array<std::uint16_t, 256> entries = {};
+
+    /// The number of TLB misses resolved with the shadow table.
+    std::size_t hits = 0;
+
+    /// The number of TLB misses that required a page walk.
+    std::size_t misses = 0;
+
+  };
+
+  /// The host-side shadow of the translation table, which is disabled by default.
+  ShadowTable shadow;
+
+  /// The prefetcher inserting translations in the TLB ahead of the accesses.
+  ///
+  /// The prefetcher is disabled by default. It is enabled by assigning it a depth.
+  TLBPrefetcher tlb_prefetcher;
+
+  /// The per-page counters of the accesses issued to the machine.
+  PageHeatmap heatmap;
+
+  /// The thresholds on the number of free frames that drive background reclaim.
+  ///
+  /// When an allocation leaves fewer than `low` free frames, the reclaim daemon (see `kswapd`) is
+  /// woken up. It evicts cold pages until at least `high` frames are free, so that faults normally
+  /// find a free frame without having to evict a page on their critical path. Background reclaim
+  /// is disabled if `low` is zero.
+  struct Watermarks {
+
+    /// The number of free frames below which the reclaim daemon is woken up.
+    std::size_t low = 0;
+
+    /// The number of free frames at which the reclaim daemon stops.
+    std::size_t high = 0;
+
+  };
+
+  /// Statistics about page reclaim.
+  struct ReclaimStatistics {
+
+    /// The number of pages evicted on the critical path of an allocation.
+    std::size_t direct = 0;
+
+    /// The number of pages evicted by the reclaim daemon.
+    std::size_t background = 0;
+
+    /// The number of times the reclaim daemon has run.
+    std::size_t wakeups = 0;
+
+    /// The cost of background reclaim, in cycles, which is not charged to any access.
+    std::uint64_t background_cycles = 0;
+
+  };
+
+  /// The thresholds driving background reclaim.
+  Watermarks watermarks;
+
+  /// Statistics about page reclaim.
+  ReclaimStatistics reclaim_statistics;
+
+  /// Statistics about page migration and large pages.
+  struct CompactionStatistics {
+
+    /// The number of pages moved from a frame to another (see `migrate_frame`).
+    std::size_t migrations = 0;
+
+    /// The number of runs of frames freed by `compact`.
+    std::size_t compactions = 0;
+
+    /// The number of large pages created by `collapse_large_page`.
+    std::size_t collapses = 0;
+
+    /// The number of large pages split by `split_large_page`.
+    std::size_t splits = 0;
+
+  };
+
+  /// Statistics about page migration and large pages.
+  CompactionStatistics compaction_statistics;
+
+  /// Statistics about the frames removed from the machine.
+  struct BalloonStatistics {
+
+    /// The number of frames removed (see `remove_frame`).
+    std::size_t removals = 0;
+
+    /// The number of frames given back (see `restore_frame`).
+    std::size_t restorations = 0;
+
+    /// The number of pages moved to another frame to remove the frame storing them.
+    std::size_t migrations = 0;
+
+    /// The number of pages evicted to remove the frame storing them.
+    std::size_t evictions = 0;
+
+  };
+
+  /// The frames removed from the machine, one bit per frame.
+  ///
+  /// A removed frame is marked used and pinned, so that it is neither allocated nor chosen as a
+  /// victim, but it stores no page.
+  std::uint16_t removed_frames = 0;
+
+  /// Statistics about the frames removed from the machine.
+  BalloonStatistics balloon_statistics;
+
+  /// `true` iff the reclaim daemon has been woken up and has not run yet.
+  bool kswapd_pending = false;
+
+  /// `true` iff the reclaim daemon is running.
+  bool kswapd_running = false;
+
+  /// The core issuing memory accesses.
+  ///
+  /// The machine has a single CPU, but it can be shared by several cores in turn (e.g., by a
+  /// scheduler), whose accesses are accounted for separately in `latency`.
+  std::size_t core = 0;
+
+  /// The number of protection keys.
+  static constexpr std::size_t pkey_count = 16;
+
+  /// A right on a protection key that disables all accesses to the pages of that key.
+  static constexpr std::uint32_t pkey_disable_access = 1;
+
+  /// A right on a protection key that disables writes to the pages of that key.
+  static constexpr std::uint32_t pkey_disable_write = 2;
+
+  /// The protection key of each page, indexed by page number (see `pkey_mprotect`).
+  ///
+  /// Hardware with protection keys stores the key of a page in its entry. Since entries have no
+  /// spare bits, keys are stored in this table instead, which the TLB is assumed to cache along
+  /// with the entries.
+  std::array<std::uint8_t, 256> page_keys = {};
+
+  /// The protection keys that have been allocated, as a bit set. Key 0 is always allocated.
+  std::uint16_t allocated_pkeys = 1;
+
+  /// The rights of each core on each protection key, in the layout of x86's PKRU register: the
+  /// rights on key `k` are stored in bits `2k` and `2k + 1`.
+  std::vector<std::uint32_t> pkey_rights = std::vector<std::uint32_t>(1);
+
+  /// A fault delivered to a handler registered with `register_fault_handler`.
+  struct UserFault {
+
+    /// The mode of the handler to which the fault is delivered.
+    std::uint8_t mode;
+
+    /// The address whose translation faulted.
+    VirtualAddress address;
+
+    /// The permissions of the access that faulted.
+    PageEntry::Protection permissions;
+
+  };
+
+  /// A handler resolving faults in a region of the virtual address space.
+  using FaultHandler = std::function<void(Machine&, UserFault const&)>;
+
+  /// A mode of a fault handler that receives accesses to pages that are not mapped.
+  static constexpr std::uint8_t uffd_missing = 1;
+
+  /// A mode of a fault handler that receives writes to pages that are write-protected (see
+  /// `uffd_write_protect`).
+  static constexpr std::uint8_t uffd_write_protect_mode = 2;
+
+  /// A region of the virtual address space whose faults are delivered to a handler.
+  struct UserFaultRegion {
+
+    /// The number of bytes in the region.
+    std::size_t length;
+
+    /// The kinds of faults delivered to the handler.
+    std::uint8_t modes;
+
+    /// The handler.
+    FaultHandler handler;
+
+  };
+
+  /// Statistics about the faults delivered to registered handlers.
+  struct UserFaultStatistics {
+
+    /// The number of accesses to pages that were not mapped.
+    std::size_t missing = 0;
+
+    /// The number of writes to pages that were write-protected.
+    std::size_t write_protect = 0;
+
+  };
+
+  /// The regions whose faults are delivered to a handler, indexed by their first address.
+  std::map<std::uint16_t, UserFaultRegion> user_fault_regions;
+
+  /// The pages that have been write-protected with `uffd_write_protect`, indexed by page number.
+  std::bitset<256> write_protected;
+
+  /// Statistics about the faults delivered to registered handlers.
+  UserFaultStatistics user_fault_statistics;
+
+  /// The handle of a file opened by the machine (see `open_file`).
+  using FileHandle = std::uint16_t;
+
+  /// A file of the host that can be mapped in the virtual address space (see `mmap_file`).
+  struct File {
+
+    /// The contents of the file.
+    std::fstream stream;
+
+    /// The size of the file when it was opened, in bytes.
+    std::size_t size;
+
+  };
+
+  /// A page of a file in the page cache.
+  struct CachedPage {
+
+    /// The file containing the page.
+    FileHandle file;
+
+    /// The index of the page in the file.
+    std::uint16_t index;
+
+    /// The frame storing the page, or `0xff` if the page is not in main memory.
+    std::uint8_t frame;
+
+    /// `true` iff the contents of the frame has been modified since it was read from the file.
+    bool dirty;
+
+    /// The number of page entries mapping the page.
+    std::uint8_t mappings = 0;
+
+  };
+
+  /// Statistics about the page cache.
+  struct PageCacheStatistics {
+
+    /// The number of faults on pages that were already stored in a frame.
+    std::size_t hits = 0;
+
+    /// The number of faults that required reading a page from its file.
+    std::size_t misses = 0;
+
+    /// The number of pages written back to their file.
+    std::size_t writebacks = 0;
+
+  };
+
+  /// The files opened by the machine, indexed by their handle.
+  std::vector<File> files;
+
+  /// The pages of the files that have been mapped.
+  ///
+  /// The identifier of a page is its position in this table plus one, so that it is never zero. A
+  /// page entry mapping a file stores that identifier in its frame number while the page is not in
+  /// main memory, and the frame storing the page stores it as its permanent position otherwise
+  /// (see `FrameDescriptor`). Hence, at most 1023 pages can be cached. Pages are never removed.
+  std::vector<CachedPage> page_cache;
+
+  /// The identifier of each page in `page_cache`, indexed by file and page index.
+  std::map<std::pair<FileHandle, std::uint16_t>, std::uint16_t> page_cache_index;
+
+  /// Statistics about the page cache.
+  PageCacheStatistics page_cache_statistics;
+
   /// A table describing how each frame of the main memory is occupied.
   ///
   /// This table occupies 64 byte: 16 x 4 bytes for each frame that can reside in main memory.
@@ -542,6 +961,32 @@ struct Machine {
     return rebind<std::uint16_t>(main_memory + 64 + 2 + 2);
   }
 
+  /// The head of the list of free 16-byte blocks in the kernel's heap, or 0 if this list is empty.
+  ///
+  /// Each free block stores the physical address of the next one in its first 2 bytes.
+  ///
+  /// This property occupies 2 bytes: 16 bits to store the offset of the first free block.
+  inline std::uint16_t& kfree_list() {
+    return *rebind<std::uint16_t>(main_memory + 64 + 2 + 2 + 8);
+  }
+
+  /// The end of the kernel's heap.
+  ///
+  /// The heap starts in the first frame and grows into the next ones, which are then pinned. The
+  /// kernel break never exceeds this limit.
+  ///
+  /// This property occupies 2 bytes: 16 bits to store the offset of the end of the heap.
+  inline std::uint16_t& klimit() {
+    return *rebind<std::uint16_t>(main_memory + 64 + 2 + 2 + 8 + 2);
+  }
+
+  /// The maximum number of frames that the kernel's heap can occupy.
+  ///
+  /// This bound is set by the back references of the frame table, which can only refer to page
+  /// entries stored in the first 1KB of main memory (see `FrameDescriptor`). It is large enough to
+  /// store a complete page translation table.
+  static constexpr std::size_t max_kernel_frames = 4;
+
   /// The number of bits by which an address should be shifted to the right to read the index of
   /// `(i + 1)`-th translation directory level.
   static constexpr std::uint16_t shifts[3] = {11, 8};
@@ -549,6 +994,15 @@ struct Machine {
   /// The mask to apply to read the index of the `(i + 1)`-th translation directory level.
   static constexpr std::uint16_t masks[2] = {0xc0ff, 0xf8ff};
 
+  /// The first address of the kernel's address space, which user mappings never reach.
+  static constexpr std::uint16_t kernel_lower_bound = 0xf800;
+
+  /// Returns `true` iff a page entry stored at the `i`-th level of the translation table on the
+  /// path to `va` maps a large page (see `translate`).
+  static constexpr bool is_large_page_level(VirtualAddress va, std::size_t i) {
+    return (i == 1) && (va.raw < kernel_lower_bound);
+  }
+
   /// Creates an instance and initializes its page translation table.
   ///
   /// The main data structures of the kernel (e.g., the page map) are stored in the first frame,
@@ -571,9 +1025,10 @@ struct Machine {
     auto* frame_table = this->frame_table();
     auto* page_map = this->page_map();
 
-    // Compute a 16-aligned offset after the page map to form the kernel break.
-    auto brk = std::distance(main_memory, rebind<std::byte>(page_map + 4));
+    // Compute a 16-aligned offset after the kernel's variables to form the kernel break.
+    auto brk = std::distance(main_memory, rebind<std::byte>(&this->klimit() + 1));
     brk += -(brk & 15) & 15;
+    this->klimit() = 0x0100;
 
     // Allocate d0 right after the frame table and the page map.
     auto* d0 = rebind<std::uint16_t>(main_memory + brk);
@@ -590,7 +1045,7 @@ struct Machine {
     d0[7] = pte.raw;
 
     frame_table[0].set_pinned(true);
-    frame_table[0].add_back_reference(brk);
+    frame_table[0].add_back_reference(pte_offset(rebind<PageEntry>(d0 + 7)));
     this->free_map() = 0xfffe;
   }
 
@@ -599,35 +1054,133 @@ struct Machine {
   }
 
   /// Reads a byte from physical address `pa`.
-  inline constexpr std::byte read_byte(PhysicalAddress pa) const {
+  inline std::byte read_byte(PhysicalAddress pa) {
+    if (caches.is_enabled()) { access_caches(pa, false); }
     return this->main_memory[pa.raw];
   }
 
   /// Stores `b` at physical address `pa`.
   inline void store_byte(std::byte b, PhysicalAddress pa) {
+    if (caches.is_enabled()) { access_caches(pa, true); }
     this->main_memory[pa.raw] = b;
   }
 
-  /// Allocates `byte_count` bytes of memory from the kernel's heap.
+  /// Simulates an access to `pa` through the data caches, charging the latency of each level
+  /// reached by the access.
+  void access_caches(PhysicalAddress pa, bool write) {
+    caches.access(pa.raw, write, [&](std::size_t level) {
+      if (level == 0) {
+        charge(Event::l1_access);
+      } else if (level == 1) {
+        charge(Event::l2_access);
+      } else {
+        charge_memory_access(static_cast<std::uint8_t>(pa.raw >> 8));
+      }
+    });
+  }
+
+  /// Charges an access to main memory in frame `f`, which is more expensive if `f` is not on the
+  /// NUMA node of the current core (see `FrameAllocationPolicy`).
+  void charge_memory_access(std::uint8_t f) {
+    charge(Event::memory_access);
+    auto const& p = frame_policy;
+    if ((p.node_count > 1) && (p.node_of_frame(f) != p.node_of_core(core))) {
+      charge(Event::remote_memory_access);
+    }
+  }
+
+  /// Allocates `byte_count` bytes of zero-initialized memory from the kernel's heap.
+  ///
+  /// The heap is a slab of 16-byte blocks, which is the size of a directory. Requests for a single
+  /// block are served from `kfree_list` if possible. Otherwise, memory is taken at the kernel break,
+  /// growing the heap into the next frame if necessary (see `grow_kernel_heap`).
   std::uint16_t kalloc(std::size_t byte_count) {
+    // Can we recycle a free block?
+    auto& head = this->kfree_list();
+    if ((byte_count <= 16) && (head != 0)) {
+      auto const a = head;
+      head = *rebind<std::uint16_t>(main_memory + a);
+      std::fill_n(main_memory + a, 16, std::byte{0});
+      return a;
+    }
+
     auto a = this->kbrk();
     auto b = a + byte_count;
     auto c = b + (-(b & 15) & 15);
 
-    // Did we run out of memory (max kernel occupies the two first frames).
-    if (c < 0x0200) {
-      this->kbrk() = c;
-      return a;
-    } else {
-      throw std::bad_alloc();
+    // Did we run out of memory?
+    while (c > this->klimit()) { grow_kernel_heap(); }
+    this->kbrk() = c;
+    return a;
+  }
+
+  /// Returns `byte_count` bytes at `offset`, which have been allocated with `kalloc`, to the
+  /// kernel's heap.
+  void kfree(std::uint16_t offset, std::size_t byte_count) {
+    assert(((offset & 15) == 0) && (offset + byte_count <= this->kbrk()));
+    for (std::size_t i = 0; i < byte_count; i += 16) {
+      auto const a = static_cast<std::uint16_t>(offset + i);
+      *rebind<std::uint16_t>(main_memory + a) = this->kfree_list();
+      this->kfree_list() = a;
+    }
+  }
+
+  /// Extends the kernel's heap by one frame, evicting the page stored in that frame if necessary.
+  ///
+  /// The method throws `std::bad_alloc` if the heap already occupies `max_kernel_frames` frames or
+  /// if the page stored in the next frame cannot be swapped out.
+  void grow_kernel_heap() {
+    auto const f = static_cast<std::uint8_t>(this->klimit() >> 8);
+    if (f >= max_kernel_frames) { throw std::bad_alloc(); }
+
+    auto& frame = this->frame_table()[f];
+    assert(!frame.is_pinned());
+
+    // Is the frame storing a page?
+    if (!(this->free_map() & (1 << f))) { evict(this, f); }
+
+    // Pin the frame and zero-initialize its contents.
+    frame.reset();
+    frame.set_pinned(true);
+    this->free_map() &= ~(1 << f);
+    std::fill_n(main_memory + (f << 8), 256, std::byte{0});
+    this->klimit() += 0x0100;
+  }
+
+  /// Returns a pointer to the entry of the translation table that maps `va`, or `nullptr` if `va`
+  /// is not mapped.
+  ///
+  /// Unlike `translate`, this method neither reads nor updates the TLB, never swaps pages in, and
+  /// does not check the protection of the page. If `va` is in a large page, the result is the
+  /// entry of the whole large page (see `collapse_large_page`).
+  PageEntry* lookup_entry(VirtualAddress va) {
+    auto* pda = page_map() + (va.raw >> 14);
+
+    for (auto i = 0; i < 2; ++i) {
+      if (*pda == 0) {
+        return nullptr;
+      } else if (*pda & 1) {
+        if (is_large_page_level(va, i)) { return rebind<PageEntry>(pda); }
+        return ((va.raw & ~masks[i]) == 0) ? rebind<PageEntry>(pda) : nullptr;
+      } else {
+        auto* directory = rebind<std::uint16_t>(main_memory + *pda);
+        pda = directory + ((va.raw >> shifts[i]) & 0x7);
+      }
     }
+
+    return (*pda == 0) ? nullptr : rebind<PageEntry>(pda);
+  }
+
+  /// Returns `true` iff `va` is mapped.
+  inline bool is_mapped(VirtualAddress va) {
+    return lookup_entry(va) != nullptr;
   }
 
   /// Returns the offset of the given page entry.
   ///
   /// `pte` is a pointer to a page entry that is stored in the machine's main memory.
-  inline std::uint8_t pte_offset(PageEntry const* pte) const {
-    return static_cast<std::uint8_t>(std::distance(this->main_memory, rebind<std::byte>(pte)));
+  inline std::uint16_t pte_offset(PageEntry const* pte) const {
+    return static_cast<std::uint16_t>(std::distance(this->main_memory, rebind<std::byte>(pte)));
   }
 
   /// Returns the physical address corresponding to `va` accessed with `permissions`, knowing that
@@ -647,24 +1200,41 @@ struct Machine {
     VirtualAddress va, PageEntry::Protection permissions, PageEntry& pte, bool update_tlb
   ) {
     // Does the page have the right protection?
+    if (pte.is_guard()) { throw PageLookupError{va, GuardFault}; }
     if ((pte.protection() & permissions) != permissions) {
       throw PageLookupError{va, PermissionFault};
     }
+    if ((permissions != 0) && !pkey_allows(va, permissions)) {
+      throw PageLookupError{va, ProtectionKeyFault};
+    }
 
     std::uint16_t frame_index = 0xff;
 
     // Is the page in main memory?
     if (pte.is_present()) {
       frame_index = pte.frame();
-      if (update_tlb) { tlb.insert(va.page(), pte); }
+      if (update_tlb) { tlb.insert(va.page().raw, pte.raw); }
+    }
+
+    // Otherwise, if the page is backed by a file, the frame number identifies the page in the
+    // page cache, which may already be stored in some frame.
+    else if (pte.is_file_backed()) {
+      charge_fault(va);
+      frame_index = read_cached_page(pte.frame(), va);
+      assert(frame_table()[frame_index].back_reference_count() < 2);
+      pte.set_frame(frame_index);
+      pte.set_present(true);
+      if (update_tlb) { tlb.insert(va.page().raw, pte.raw); }
+      this->frame_table()[frame_index].add_back_reference(pte_offset(&pte));
     }
 
     // Otherwise, the frame number contains the location where the page has been swapped out.
     else {
-      frame_index = swap_victim(this, pte.frame());
+      charge_fault(va);
+      frame_index = swap_in(this, va, pte.frame());
       pte.set_frame(frame_index);
       pte.set_present(true);
-      if (update_tlb) { tlb.insert(va.page(), pte); }
+      if (update_tlb) { tlb.insert(va.page().raw, pte.raw); }
 
       // Update the frame so that it points back to the page table entry that has been modified.
       // We can assume `pte` refers directly to some location in the page translation table since
@@ -672,7 +1242,18 @@ struct Machine {
       this->frame_table()[frame_index].add_back_reference(pte_offset(&pte));
     }
 
+    // Writing to a page of a file makes it dirty.
+    if ((permissions & PageEntry::write) && pte.is_file_backed()) {
+      page_cache[this->frame_table()[frame_index].permanent_position() - 1].dirty = true;
+    }
+
     this->frame_table()[frame_index].set_referenced(true);
+    if (permissions != 0) {
+      heatmap.record_access(
+        static_cast<std::uint8_t>(va.raw >> 8), static_cast<std::uint8_t>(frame_index),
+        permissions & PageEntry::write);
+    }
+    if (!caches.is_enabled()) { charge_memory_access(frame_index); }
     return PhysicalAddress{static_cast<uint16_t>((frame_index << 8) | (va.raw & 0xff))};
   }
 
@@ -681,7 +1262,8 @@ struct Machine {
   ///
   /// The translation first checks whether the page containing `va` is in the TLB. If it is, the
   /// result can be computed immediately. Otherwise, a TLB miss occurs. Note that this step is
-  /// typically carried out by the hardware in a real system.
+  /// typically carried out by the hardware in a real system. Both hits and misses are reported to
+  /// `tlb_prefetcher`, if it is enabled, which may insert other translations in the TLB.
   ///
   /// If a TLB miss occurs, the system decodes the 8 most significant bits of `va` to index the
   /// page translation table (see `VirtualAddress`). This process is referred to as a page walk.
@@ -697,7 +1279,10 @@ struct Machine {
   /// - If the entry is equal to zero, then any translation going through the corresponding node
   ///   should fail with a segfault.
   /// - If the least significant bit of the entry is set, then it encodes a PTE directly and the
-  ///   page walk can end.
+  ///   page walk can end. At *L1* and below the kernel's address space, such an entry maps a
+  ///   large page of 2KB, whose 8 pages are stored in consecutive frames starting at the one
+  ///   identified by the PTE (see `collapse_large_page`). Otherwise, it only maps the first page
+  ///   of its range.
   /// - Otherwise, the entry encodes the address of a directory in the next level as an offset in
   ///   physical memory.
   ///
@@ -714,22 +1299,53 @@ struct Machine {
   PhysicalAddress translate(
     VirtualAddress va, PageEntry::Protection permissions, F&& handle_segfault
   ) {
+    // Let the reclaim daemon run before the access, as it would have in the background.
+    if (kswapd_pending) { kswapd(); }
+    latency.begin(core);
+
     // The null address has no translation.
     if (va.raw == 0) { throw PageLookupError(va, SegmentationFault); }
 
     // Check the TLB.
-    auto pte = tlb.lookup(va.page());
+    charge(Event::tlb_lookup);
+    auto pte = PageEntry::from_raw(tlb.lookup(va.page().raw));
     if (!pte.is_none()) {
       assert(pte.is_present());
+      if (tlb_prefetcher.is_enabled()) { prefetch_on_hit(va); }
       return translate_with_entry(va, permissions, pte, false);
     }
 
+    // Let the prefetcher learn from the miss.
+    if (tlb_prefetcher.is_enabled()) {
+      auto const p = tlb_prefetcher.train(va.raw >> 8);
+      if (p.stride != 0) { prefetch_translations(va, p); }
+    }
+
+    // Look the location of the entry up in the shadow table.
+    if (shadow.enabled) {
+      if (auto const e = shadow.entries[va.raw >> 8]; e != 0) {
+        charge(Event::walk_step);
+        shadow.hits++;
+        auto& pte = *rebind<PageEntry>(main_memory + (e & ~1));
+        assert(!pte.is_none());
+        if (!(e & 1)) { return translate_with_entry(va, permissions, pte, true); }
+
+        auto large = pte;
+        large.set_frame(pte.frame() + ((va.raw >> shifts[1]) & 0x7));
+        return translate_with_entry(va, permissions, large, true);
+      }
+      shadow.misses++;
+    }
+
     // Walk the page table.
     auto* pda = page_map() + (va.raw >> 14);
 
     for (auto i = 0; i < 2; ++i) {
+      charge(Event::walk_step);
+
       // The null address has no translation.
       if (*pda == 0) {
+        charge_fault(va);
         handle_segfault(this, va, permissions, pda, i);
         assert(*pda != 0);
       }
@@ -737,10 +1353,20 @@ struct Machine {
       // If the least significant bit of `pda` is set, then it encodes a page entry rather than a
       // directory address.
       if (*pda & 1) {
+        // A large page is always present and its pages are stored in consecutive frames.
+        if (is_large_page_level(va, i)) {
+          auto pte = *rebind<PageEntry>(pda);
+          assert(pte.is_present());
+          shadow_fill(va, rebind<PageEntry>(pda), true);
+          pte.set_frame(pte.frame() + ((va.raw >> shifts[1]) & 0x7));
+          return translate_with_entry(va, permissions, pte, true);
+        }
+
         // Make sure the remaining directory bits are zeroed-out.
         if ((va.raw & ~masks[i]) != 0) { throw PageLookupError(va, SegmentationFault); }
 
         // Decode the page entry.
+        shadow_fill(va, rebind<PageEntry>(pda), false);
         return translate_with_entry(va, permissions, *rebind<PageEntry>(pda), true);
       }
 
@@ -754,15 +1380,31 @@ struct Machine {
       else { std::abort(); }
     }
 
+    charge(Event::walk_step);
     if (*pda == 0) {
+      charge_fault(va);
       handle_segfault(this, va, permissions, pda, 2);
       assert(*pda != 0);
     }
 
     // If we got there, `pda` encodes the raw contents of some page table entry.
+    shadow_fill(va, rebind<PageEntry>(pda), false);
     return translate_with_entry(va, permissions, *rebind<PageEntry>(pda), true);
   }
 
+  /// Records in the shadow table, if it is enabled, that the entry of the page containing `va` is
+  /// `pte`, which maps a large page iff `large` is `true`.
+  inline void shadow_fill(VirtualAddress va, PageEntry const* pte, bool large) {
+    if (shadow.enabled) {
+      shadow.entries[va.raw >> 8] = static_cast<std::uint16_t>(pte_offset(pte) | (large ? 1 : 0));
+    }
+  }
+
+  /// Clears the entries of the shadow table for the `count` pages from the page containing `va`.
+  inline void shadow_invalidate(VirtualAddress va, std::size_t count = 1) {
+    std::fill_n(shadow.entries.begin() + (va.raw >> 8), count, std::uint16_t{0});
+  }
+
 
 
 
@@ -771,12 +1413,173 @@ struct Machine {
 
 
 
+  /// Inserts in the TLB the translations of the `tlb_prefetcher.depth` pages following the page
+  /// containing `va` along the stride of `p`, on behalf of the stream that made `p`.
+  ///
+  /// The walks are speculative: pages that are not mapped or not present are skipped rather than
+  /// faulting, and their cost is not charged to the current access since a hardware prefetcher
+  /// would walk the translation table off the critical path.
+  void prefetch_translations(VirtualAddress va, TLBPrefetcher::Prediction p) {
+    auto& prefetcher = tlb_prefetcher;
+    auto const first = static_cast<std::int32_t>(va.raw >> 8);
+    for (std::size_t k = 1; k <= prefetcher.depth; ++k) {
+      auto const n = first + static_cast<std::int32_t>(k) * p.stride;
+      if ((n <= 0) || (n > 0xff)) { break; }
+
+      auto const page = VirtualAddress{static_cast<std::uint16_t>(n << 8)};
+      if (tlb.contains(page.raw)) { continue; }
+      prefetcher.statistics.walks++;
+      auto* pte = lookup_entry(page);
+      if ((pte == nullptr) || !pte->is_present()) { continue; }
+
+      auto e = *pte;
+      if (find_large_page(page) == pte) { e.set_frame(e.frame() + (n & 0x7)); }
+      tlb.insert(page.raw, e.raw);
+      prefetcher.issue(n, p.stream);
+    }
+    prefetcher.retire([&](std::int32_t n) {
+      return tlb.contains(static_cast<std::uint16_t>(n << 8));
+    });
+  }
+
+  /// Notifies the prefetcher of a TLB hit on `va`, prefetching further along the stream that
+  /// prefetched the translation of `va`, if any.
+  void prefetch_on_hit(VirtualAddress va) {
+    auto& prefetcher = tlb_prefetcher;
+    prefetcher.retire([&](std::int32_t n) {
+      return tlb.contains(static_cast<std::uint16_t>(n << 8));
+    });
+    if (auto const p = prefetcher.consume(va.raw >> 8); p && (p->stride != 0)) {
+      prefetch_translations(va, *p);
+    }
+  }
+
   /// Returns the physical address corresponding to `va` accessed with `permissions`, throwing
   /// if `va` is not mapped or if the protection of the page are incompatible with `permissions`.
+  ///
+  /// If `va` is in a region registered with `register_fault_handler`, accesses to pages that are
+  /// not mapped and writes to pages that are write-protected are delivered to the handler of the
+  /// region, in the corresponding modes. The access is retried once the handler returns, as a
+  /// faulting instruction would be, and throws if the handler did not resolve the fault.
   PhysicalAddress translate(VirtualAddress va, PageEntry::Protection permissions) {
+    if (user_fault_regions.empty()) { return translate(va, permissions, &Machine::rethrow); }
+
+    std::uint8_t mode = 0;
+    try {
+      return translate(va, permissions, &Machine::rethrow);
+    } catch (PageLookupError const& e) {
+      if (e.cause == SegmentationFault) {
+        mode = uffd_missing;
+      } else if ((e.cause == PermissionFault) && (permissions & PageEntry::write)
+        && write_protected[va.raw >> 8])
+      {
+        mode = uffd_write_protect_mode;
+      }
+      auto* r = user_fault_region(va, mode);
+      if (r == nullptr) { throw; }
+
+      ((mode == uffd_missing)
+        ? user_fault_statistics.missing
+        : user_fault_statistics.write_protect)++;
+      r->handler(*this, UserFault{mode, va, permissions});
+    }
     return translate(va, permissions, &Machine::rethrow);
   }
 
+  /// Registers `handler` to resolve the faults in the region of `length` bytes from `va` in the
+  /// given `modes`, which is a combination of `uffd_missing` and `uffd_write_protect_mode`.
+  ///
+  /// The region must be page-aligned, below the kernel's address space, and disjoint from other
+  /// registered regions. The handler is expected to resolve a fault with `uffd_copy`,
+  /// `uffd_zeropage`, or `uffd_write_protect`, as a userfaultfd handler would on Linux. It can
+  /// also throw to abort the access.
+  void register_fault_handler(
+    VirtualAddress va, std::size_t length, std::uint8_t modes, FaultHandler handler
+  ) {
+    if ((length == 0) || ((length & 0xff) != 0) || (va.page().raw != va.raw)
+      || (va.raw == 0) || (va.raw + length > kernel_lower_bound))
+    {
+      throw std::invalid_argument("invalid region");
+    }
+    auto const next = user_fault_regions.lower_bound(va.raw);
+    if ((next != user_fault_regions.end()) && (next->first < va.raw + length)) {
+      throw std::invalid_argument("overlapping regions");
+    }
+    if (next != user_fault_regions.begin()) {
+      auto const previous = std::prev(next);
+      if (previous->first + previous->second.length > va.raw) {
+        throw std::invalid_argument("overlapping regions");
+      }
+    }
+    user_fault_regions.emplace(va.raw, UserFaultRegion{length, modes, std::move(handler)});
+  }
+
+  /// Unregisters the handler of the region starting at `va`, if any.
+  void unregister_fault_handler(VirtualAddress va) {
+    user_fault_regions.erase(va.raw);
+  }
+
+  /// Returns the region containing `va` whose handler resolves faults in `mode`, if any.
+  UserFaultRegion* user_fault_region(VirtualAddress va, std::uint8_t mode) {
+    auto r = user_fault_regions.upper_bound(va.raw);
+    if (r == user_fault_regions.begin()) { return nullptr; }
+    --r;
+    auto const contains = va.raw < r->first + r->second.length;
+    return (contains && (r->second.modes & mode)) ? &r->second : nullptr;
+  }
+
+  /// Maps the unmapped page at `va` with `protection`, filling it with the contents of `page`.
+  void uffd_copy(
+    VirtualAddress va, std::span<std::byte const, 256> page, PageEntry::Protection protection
+  ) {
+    if ((va.page().raw != va.raw) || is_mapped(va)) {
+      throw std::invalid_argument("page already mapped");
+    }
+    auto const pa = translate(va, 0, [&](
+      Machine* self, VirtualAddress, PageEntry::Protection, std::uint16_t* pda, std::size_t i
+    ) {
+      allocate_on_segfault(self, va, protection, pda, i);
+    });
+    std::copy(page.begin(), page.end(), main_memory + pa.raw);
+  }
+
+  /// Maps the unmapped page at `va` with `protection`, filling it with zeros.
+  void uffd_zeropage(VirtualAddress va, PageEntry::Protection protection) {
+    std::array<std::byte, 256> const zeros = {};
+    uffd_copy(va, zeros, protection);
+  }
+
+  /// Write-protects the mapped pages containing the addresses in the range from `va` to
+  /// `va + length` if `enabled` is `true`, or removes their write protection otherwise.
+  ///
+  /// A write-protected page loses its write permission, so that writes to it fault and are
+  /// delivered to the handler of its region in mode `uffd_write_protect_mode`, until the
+  /// permission is restored by removing the protection. Pages that cannot be written to are left
+  /// unchanged. Large pages in the range are split.
+  void uffd_write_protect(VirtualAddress va, std::size_t length, bool enabled) {
+    if ((va.page().raw != va.raw) || (va.raw + length > kernel_lower_bound)) {
+      throw std::invalid_argument("invalid region");
+    }
+    for (std::size_t i = 0; i < length; i += 256) {
+      auto const page = va.advanced(static_cast<std::uint16_t>(i));
+      split_large_page(page);
+      auto* pte = lookup_entry(page);
+      if ((pte == nullptr) || pte->is_guard()) { continue; }
+
+      auto const n = page.raw >> 8;
+      auto const protection = pte->protection();
+      if (enabled && (protection & PageEntry::write)) {
+        tlb.invalidate(pte->raw);
+        pte->set_protection(static_cast<PageEntry::Protection>(protection & ~PageEntry::write));
+        write_protected[n] = true;
+      } else if (!enabled && write_protected[n]) {
+        tlb.invalidate(pte->raw);
+        pte->set_protection(static_cast<PageEntry::Protection>(protection | PageEntry::write));
+        write_protected[n] = false;
+      }
+    }
+  }
+
   /// Allocates a page at the page-aligned address `va`, assuming it isn't already allocated.
   PhysicalAddress allocate_page(VirtualAddress va, PageEntry::Protection ps) {
     return translate(va, ps, &Machine::allocate_on_segfault);
@@ -791,112 +1594,685 @@ struct Machine {
   /// address that may or may not depend on the hint.
   ///
   /// The address of the new mapping is returned as the result of the call.
+  ///
+  /// If `guard_pages` is not zero, the mapping is surrounded by that many guard pages on each
+  /// side. Guard pages are mapped, so that no other mapping is placed there, but any access to
+  /// them faults with a `GuardFault` before any other check. They occupy no frame and are removed
+  /// like other pages, e.g., by unmapping them together with the mapping.
   VirtualAddress simple_mmap(
-    VirtualAddress hint, std::size_t length, PageEntry::Protection protection) {
-         // So I presume I'm supposed to find a new location to fit data of size size_t with specific perms.
-        // When using this function, we are given this:
-       //            m.simple_mmap(0, 128, PageEntry::read | PageEntrey::Write)
-      // This is found inside of the test-all.cc file. (I was confused what we were given when this function
-     // is called). I think you can access the bit values by using x.raw ?
-    // Pretty sure the length is bytes.. I'm assuming, so if something's wrong.. then it's probably this.
+    VirtualAddress hint, std::size_t length, PageEntry::Protection protection,
+    std::size_t guard_pages = 0
+  ) {
+    if (length == 0) { throw std::invalid_argument("empty mapping"); }
+
+    // The number of pages required to store `length` bytes.
+    auto const page_count = (length + 255) >> 8;
+    auto const total = page_count + 2 * guard_pages;
+    auto const start = (hint.raw < (guard_pages << 8))
+      ? hint
+      : hint.advanced(static_cast<std::uint16_t>(-(guard_pages << 8)));
+    VirtualAddress const region = find_free_region(start, total);
+    VirtualAddress const result = region.advanced(static_cast<std::uint16_t>(guard_pages << 8));
+
+    // Map each page of the region, undoing the mapping if the system runs out of memory.
+    for (std::size_t i = 0; i < total; ++i) {
+      auto const va = region.advanced(static_cast<std::uint16_t>(i << 8));
+      try {
+        if ((i < guard_pages) || (i >= guard_pages + page_count)) {
+          *create_entry(va) = PageEntry::guard();
+        } else {
+          allocate_page(va, protection);
+        }
+      } catch (std::bad_alloc const&) {
+        if (i > 0) { simple_munmap(region, i << 8); }
+        throw;
+      }
+    }
+    return result;
+  }
+
+  /// Returns a protection key that is not allocated, after allocating it, or throws
+  /// `std::bad_alloc` if all keys are allocated.
+  ///
+  /// The rights of every core on the new key are reset.
+  std::uint8_t pkey_alloc() {
+    auto const available = static_cast<std::uint16_t>(~allocated_pkeys);
+    if (available == 0) { throw std::bad_alloc(); }
+    auto const k = static_cast<std::uint8_t>(std::countr_zero(available));
+    allocated_pkeys |= static_cast<std::uint16_t>(1 << k);
+    for (auto& r : pkey_rights) { r &= ~(std::uint32_t{3} << (2 * k)); }
+    return k;
+  }
+
+  /// Frees the protection key `k`, which must not be assigned to any page.
+  void pkey_free(std::uint8_t k) {
+    if ((k == 0) || (k >= pkey_count)) { throw std::invalid_argument("invalid protection key"); }
+    allocated_pkeys &= static_cast<std::uint16_t>(~(1 << k));
+  }
+
+  /// Assigns the allocated protection key `k` to the pages containing the addresses in the range
+  /// from `va` to `va + length`, which must all be mapped.
+  ///
+  /// Neither page entries nor the TLB are modified. A page gets the key 0 back when it is unmapped.
+  void pkey_mprotect(VirtualAddress va, std::size_t length, std::uint8_t k) {
+    if ((k >= pkey_count) || !(allocated_pkeys & (1 << k))) {
+      throw std::invalid_argument("invalid protection key");
+    }
+    if ((length == 0) || (va.page().raw != va.raw) || (va.raw + length > kernel_lower_bound)) {
+      throw std::invalid_argument("invalid mapping");
+    }
+    for (std::size_t i = 0; i < length; i += 256) {
+      if (!is_mapped(static_cast<std::uint16_t>(va.raw + i))) {
+        throw std::invalid_argument("invalid mapping");
+      }
+    }
+    for (std::size_t i = 0; i < length; i += 256) { page_keys[(va.raw + i) >> 8] = k; }
+  }
+
+  /// Sets the rights of the current core on the protection key `k`, which is a combination of
+  /// `pkey_disable_access` and `pkey_disable_write`.
+  ///
+  /// This operation is as cheap as writing a register: it takes effect on the next access without
+  /// modifying page entries or flushing the TLB.
+  void pkey_set(std::uint8_t k, std::uint32_t rights) {
+    if (k >= pkey_count) { throw std::invalid_argument("invalid protection key"); }
+    if (core >= pkey_rights.size()) { pkey_rights.resize(core + 1); }
+    auto& r = pkey_rights[core];
+    r = (r & ~(std::uint32_t{3} << (2 * k))) | ((rights & 3) << (2 * k));
+  }
 
-     // This is the final result, which is a 16bit int as described at line 48 and is the value we return.
-    VirtualAddress resultVirtualAddress = 0;
+  /// Returns `true` iff the rights of the current core on the protection key of the page containing
+  /// `va` allow an access with `permissions`.
+  ///
+  /// As on x86, protection keys only restrict reads and writes.
+  inline bool pkey_allows(VirtualAddress va, PageEntry::Protection permissions) const {
+    if (core >= pkey_rights.size()) { return true; }
+    auto const rights = (pkey_rights[core] >> (2 * page_keys[va.raw >> 8])) & 3;
+    if ((rights & pkey_disable_access) && (permissions & (PageEntry::read | PageEntry::write))) {
+      return false;
+    }
+    return !((rights & pkey_disable_write) && (permissions & PageEntry::write));
+  }
 
-     // The 8LSB together are the frame offset.
-    // The 2MSB is L0, next 3 L1 and final 3 L3.
+  /// Returns the address of the first region of `page_count` unmapped pages from the page
+  /// containing `hint`, wrapping around once, or throws `std::bad_alloc` if there is none.
+  ///
+  /// If `hint` is null, the search starts at `0x1000`. The first page is never used since it
+  /// contains the null address, and the region must fit below the kernel's address space.
+  VirtualAddress find_free_region(VirtualAddress hint, std::size_t page_count) {
+    // The mapping must fit below the kernel's address space.
+    if (page_count > (kernel_lower_bound >> 8) - 1) { throw std::bad_alloc(); }
+    auto const last_candidate = kernel_lower_bound - (page_count << 8);
+
+    // Returns `true` iff `page_count` pages starting at `a` are unmapped.
+    auto const is_free = [&](std::size_t a) {
+      for (std::size_t i = 0; i < page_count; ++i) {
+        if (is_mapped(static_cast<std::uint16_t>(a + (i << 8)))) { return false; }
+      }
+      return true;
+    };
+
+    // Look for a free region from the page containing `hint`, wrapping around once. The first
+    // page is never used since it contains the null address.
+    std::size_t start = (hint.raw == 0) ? 0x1000 : hint.page().raw;
+    if ((start == 0) || (start > last_candidate)) { start = 0x0100; }
+
+    auto a = start;
+    while (!is_free(a)) {
+      a = (a < last_candidate) ? (a + 0x100) : 0x0100;
+      if (a == start) { throw std::bad_alloc(); }
+    }
+    return VirtualAddress{static_cast<std::uint16_t>(a)};
+  }
 
+  /// Opens the file at `path` on the host for reading and writing and returns its handle.
+  FileHandle open_file(std::string const& path) {
+    std::fstream stream(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!stream) { throw std::invalid_argument("cannot open " + path); }
+    stream.seekg(0, std::ios::end);
+    auto const size = static_cast<std::size_t>(stream.tellg());
 
-    //***********OVERVIEW *************//
-       // - We are given a wanted size with perms.
-      // - Perms are handled in the page section. (more precisly the Page Table Entry)
-     // - Pages are contained withing frames..
-    // - Hunh..
+    files.push_back({std::move(stream), size});
+    return static_cast<FileHandle>(files.size() - 1);
+  }
 
-        // So basically, we have to start with a hint which hints us where to start.
-       // Then we have a size.
-      // From that size, we have to access the the physical memory.
-     // Find and create a frame.
-    // From that frame insert a page in which we assign the correct permissions.
+  /// Creates a new mapping of `length` bytes of `file`, from `offset`, in the virtual address
+  /// space with the specified `protection`, and returns its address.
+  ///
+  /// The address of the mapping is chosen as in `simple_mmap`. However, no frame is allocated
+  /// until a page of the mapping is accessed, at which point it is read from the file through the
+  /// page cache. Mappings of the same file share the frames of the page cache. A modified page is
+  /// written back to its file when its frame is evicted or when `sync_files` is called.
+  ///
+  /// `offset` must be page-aligned. The part of the last page past the end of the file reads as
+  /// zeros and is never written back. A page of a file can be shared by at most two mappings, which
+  /// is the capacity of the back-reference list of a frame descriptor (see `FrameDescriptor`). The
+  /// method throws `std::invalid_argument`, leaving the machine unchanged, if a page of the file is
+  /// already mapped twice.
+  VirtualAddress mmap_file(
+    VirtualAddress hint, std::size_t length, PageEntry::Protection protection,
+    FileHandle file, std::size_t offset
+  ) {
+    if (length == 0) { throw std::invalid_argument("empty mapping"); }
+    if (file >= files.size()) { throw std::invalid_argument("invalid file"); }
+    if (((offset & 0xff) != 0) || (((offset + length) >> 8) > 0xffff)) {
+      throw std::invalid_argument("invalid offset");
+    }
 
-    // Starting from scratch. We want:
-    // To export a virtual address that is one 16bit integer. It contains the path to the right area ?
-    // We reach the corresponding frame, from which we can reach the correct page.
-    // Something with the translation lookaside buffer.
+    auto const page_count = (length + 255) >> 8;
+    for (std::size_t i = 0; i < page_count; ++i) {
+      auto const j = page_cache_index.find({file, static_cast<std::uint16_t>((offset >> 8) + i)});
+      if ((j != page_cache_index.end()) && (page_cache[j->second - 1].mappings >= 2)) {
+        throw std::invalid_argument("file page already mapped twice");
+      }
+    }
+    VirtualAddress const result = find_free_region(hint, page_count);
+
+    // Write an entry that is not present for each page of the region.
+    for (std::size_t i = 0; i < page_count; ++i) {
+      try {
+        auto const id = cached_page(file, static_cast<std::uint16_t>((offset >> 8) + i));
+        auto* pte = create_entry(result.advanced(static_cast<std::uint16_t>(i << 8)));
+        *pte = PageEntry{};
+        pte->set_protection(protection);
+        pte->set_file_backed(true);
+        pte->set_frame(id);
+        page_cache[id - 1].mappings++;
+      } catch (std::bad_alloc const&) {
+        if (i > 0) { simple_munmap(result, i << 8); }
+        throw;
+      }
+    }
+    return result;
+  }
 
-    // A lot of throaway comments.
+  /// Returns the identifier of the page at `index` in `file` in the page cache, adding that page to
+  /// the cache if necessary.
+  std::uint16_t cached_page(FileHandle file, std::uint16_t index) {
+    auto const [i, inserted] = page_cache_index.try_emplace({file, index}, 0);
+    if (inserted) {
+      if (page_cache.size() >= 1023) {
+        page_cache_index.erase(i);
+        throw std::bad_alloc();
+      }
+      page_cache.push_back({file, index, 0xff, false});
+      i->second = static_cast<std::uint16_t>(page_cache.size());
+    }
+    return i->second;
+  }
 
+  /// Returns the index of the frame storing the page identified by `id` in the page cache, reading
+  /// the page from its file if necessary, on behalf of an access to `va`.
+  std::uint8_t read_cached_page(std::uint16_t id, VirtualAddress va) {
+    if (page_cache[id - 1].frame != 0xff) {
+      page_cache_statistics.hits++;
+      return page_cache[id - 1].frame;
+    }
+    page_cache_statistics.misses++;
+
+    // Note that acquiring a frame may evict another page of the cache.
+    auto const f = acquire_frame(this, va);
+    auto& page = page_cache[id - 1];
+    auto& file = files[page.file];
+    auto* contents = main_memory + (f << 8);
+    std::fill_n(contents, 256, std::byte{0});
+
+    auto const position = std::size_t{page.index} << 8;
+    charge(Event::file_read);
+    if (position < file.size) {
+      file.stream.clear();
+      file.stream.seekg(static_cast<std::streamoff>(position));
+      file.stream.read(
+        rebind<char>(contents),
+        static_cast<std::streamsize>(std::min<std::size_t>(256, file.size - position)));
+    }
 
+    frame_table()[f].set_permanent_position(id);
+    page.frame = f;
+    page.dirty = false;
+    return f;
+  }
 
-       // Firstly, when it means the hint is null.. I believe it means that it's a 
-      // null address, therefor it's representation is = 0. So the first if statement is if (hint == 0).
-     // If true, then we start at 0x1000.
-    // And if not, then we just start at hint.
-    if (hint.raw == 0) {
-      resultVirtualAddress = VirtualAddress{0x1000};
-    } else {
-      resultVirtualAddress = hint;
-    }
-
-         // Next the size.. so need to know how many pages we need to fit the entire data into.
-        // One page is 256bytes so we would need length / 256 but rounded up cause if 
-       // llength = 120 => nbrPages = 0.xxx. Just taking the same type as size: size_t.
-      // std::size_t nbrPages = ceil(length / 256)
-     // damn can't use ceil without importing a library..
-    // Just do it manually lmao just by adding 256 before dividing
-    std::size_t nbrPages = (length + 256) / 256;
-
-
-    // Have to align it
-    resultVirtualAddress = resultVirtualAddress.page();
-
-
-         // Now for the searching: need to keep going until found, or out of bounds.
-        // So will have the bounds as the condidtion and a break function as found at the end.
-       // hehe commented the kernel bounds code when reading it.. preshoted
-      // So the start of the kernel space is definitly 0xf800 and goes to 0xffff I imagine,
-     // since the comments said that 0xf800 to 0xf8ff was the translation table, which
-    // is in the kernel space and goes up => kernel space upper bound 0xffff.
-    std::size_t kernelLowerBound = 0xf800;
-    bool foundOne = false;
-    VirtualAddress startingPoint = resultVirtualAddress;
-
-    // Looks for a section containing enough pages to satisfy the date => nbrPages.
-    while (resultVirtualAddress.raw < kernelLowerBound){
-      // added try/catch after to resolve the gad dam error handling.
-      try{
-        foundOne = true;
-        for(std::size_t i = 0; i < nbrPages && foundOne; i++){    // goes through all pages one by one
-          translate(resultVirtualAddress.advanced(i * 256), 0);  // with the premade translate function
-          foundOne = false;                                     // we can see if it has the right perms
-        }                                                      // and throws to catch if perms don't 
-        } catch (PageLookupError const& e) {                  // allow or if va not mapped => means it's freeee.
-            if (e.cause == SegmentationFault) {              // SegementationFault means Page was not mapped
-              if (foundOne) break;                          // but if it found an area that is free, it just
-            }                                              // exits.
+  /// Writes the page identified by `id` in the page cache back to its file if it is in main
+  /// memory and has been modified.
+  void write_back(std::uint16_t id) {
+    auto& page = page_cache[id - 1];
+    if (!page.dirty || (page.frame == 0xff)) { return; }
+
+    auto& file = files[page.file];
+    auto const position = std::size_t{page.index} << 8;
+    if (position < file.size) {
+      file.stream.clear();
+      file.stream.seekp(static_cast<std::streamoff>(position));
+      file.stream.write(
+        rebind<char const>(main_memory + (page.frame << 8)),
+        static_cast<std::streamsize>(std::min<std::size_t>(256, file.size - position)));
+    }
+    page.dirty = false;
+    page_cache_statistics.writebacks++;
+    charge(Event::file_write);
+  }
+
+  /// Writes all modified pages of the page cache back to their files.
+  void sync_files() {
+    for (std::size_t i = 0; i < page_cache.size(); ++i) {
+      write_back(static_cast<std::uint16_t>(i + 1));
+    }
+    for (auto& f : files) { f.stream.flush(); }
+  }
+
+  /// Returns a pointer to the entry of the translation table that should map `va`, allocating the
+  /// directories on the path to that entry if necessary.
+  ///
+  /// The method throws `std::invalid_argument` if `va` is already mapped.
+  PageEntry* create_entry(VirtualAddress va) {
+    auto* pda = page_map() + (va.raw >> 14);
+    for (std::size_t i = 0; i < 2; ++i) {
+      if (*pda == 0) { return link_entry(this, va, pda, i); }
+      if (*pda & 1) { throw std::invalid_argument("page already mapped"); }
+      pda = rebind<std::uint16_t>(main_memory + *pda) + ((va.raw >> shifts[i]) & 0x7);
+    }
+    if (*pda != 0) { throw std::invalid_argument("page already mapped"); }
+    return rebind<PageEntry>(pda);
+  }
+
+  /// Removes the mappings of the pages containing the addresses in the range from `va` to
+  /// `va + length`.
+  ///
+  /// `va` must be page-aligned and the range must be below the kernel's address space. Pages in
+  /// the range that are not mapped are ignored. The frames storing unmapped pages are released and
+  /// the directories that become empty are returned to the kernel's heap. Frames storing pages of
+  /// files remain in the page cache.
+  ///
+  /// Slots of swap devices storing pages that have been swapped out are released. Slots of the
+  /// default region of secondary memory are not reclaimed.
+  void simple_munmap(VirtualAddress va, std::size_t length) {
+    if ((length == 0) || (va.page().raw != va.raw) || (va.raw + length > 0xf800)) {
+      throw std::invalid_argument("invalid mapping");
+    }
+    for (std::size_t i = 0; i < length; i += 256) {
+      unmap_page(va.advanced(static_cast<std::uint16_t>(i)));
+    }
+  }
+
+  /// Removes the mapping of the page at the page-aligned address `va`, if any.
+  ///
+  /// If the page is part of a large page, the large page is split first.
+  void unmap_page(VirtualAddress va) {
+    split_large_page(va);
+    std::uint16_t* entries[3] = {page_map() + (va.raw >> 14), nullptr, nullptr};
+
+    // Find the entry of each level on the path to the page entry.
+    for (auto i = 0; i < 2; ++i) {
+      if (*entries[i] == 0) { return; }
+      if (*entries[i] & 1) { throw std::invalid_argument("cannot unmap part of a large page"); }
+      auto* directory = rebind<std::uint16_t>(main_memory + *entries[i]);
+      entries[i + 1] = directory + ((va.raw >> shifts[i]) & 0x7);
+    }
+    if (*entries[2] == 0) { return; }
+    shadow_invalidate(va);
+    page_keys[va.raw >> 8] = 0;
+    write_protected[va.raw >> 8] = false;
+
+    // Release the frame.
+    auto* pte = rebind<PageEntry>(entries[2]);
+    if (pte->is_file_backed()) {
+      auto const id = pte->is_present()
+        ? frame_table()[pte->frame()].permanent_position()
+        : pte->frame();
+      page_cache[id - 1].mappings--;
+    }
+    if (pte->is_present()) {
+      auto const f = pte->frame();
+      auto& frame = frame_table()[f];
+      tlb.invalidate(pte->raw);
+      frame.remove_back_reference(pte_offset(pte));
+      if ((frame.back_reference_count() == 0) && (frame.permanent_position() == 0)) {
+        frame.reset();
+        free_map() |= (1 << f);
+      }
+    } else if (!pte->is_guard() && !pte->is_file_backed()) {
+      release_slot(pte->frame());
+    }
+    *entries[2] = 0;
+
+    // Release the directories that became empty.
+    for (auto i = 1; i >= 0; --i) {
+      auto* directory = main_memory + *entries[i];
+      if (std::any_of(directory, directory + 16, [](auto b) { return b != std::byte{0}; })) {
+        break;
+      }
+      kfree(*entries[i], 16);
+      *entries[i] = 0;
+    }
+  }
+
+  /// Moves the page stored in frame `from` to the free frame `to`, updating the page entries
+  /// referring to `from` through its back references.
+  ///
+  /// The descriptor of `from` is moved to `to` and `from` is marked free. The TLB entries of the
+  /// page are invalidated. `from` must store a page and must not be pinned.
+  void migrate_frame(std::uint8_t from, std::uint8_t to) {
+    auto* frame_table = this->frame_table();
+    auto& source = frame_table[from];
+    assert(!source.is_pinned() && !(free_map() & (1 << from)) && (free_map() & (1 << to)));
+
+    auto const n = source.back_reference_count();
+    if (n > 2) {
+      // Feature not implemented.
+      std::abort();
+    }
+
+    std::copy_n(main_memory + (from << 8), 256, main_memory + (to << 8));
+    for (auto i = 0; i < n; ++i) {
+      auto& pte = *rebind<PageEntry>(main_memory + source.back_reference(i));
+      assert(pte.is_present() && (pte.frame() == from));
+      tlb.invalidate(pte.raw);
+      pte.set_frame(to);
+    }
+    if (auto const id = source.permanent_position(); id != 0) { page_cache[id - 1].frame = to; }
+
+    frame_table[to] = source;
+    source.reset();
+    free_map() = static_cast<std::uint16_t>((free_map() | (1 << from)) & ~(1 << to));
+    heatmap.record_migration(from, to);
+    compaction_statistics.migrations++;
+  }
+
+  /// Frees an aligned run of `count` frames and returns the index of its first frame.
+  ///
+  /// `count` must be a power of 2 that is at most 16. The run is the one storing the fewest pages
+  /// among those that contain no pinned frame. Each page stored in that run is migrated to a free
+  /// frame outside of the run if there is one, or evicted otherwise. The method throws
+  /// `std::bad_alloc` if every run contains a pinned frame or if a page cannot be evicted, in which
+  /// case the pages moved so far remain at their new location.
+  std::uint8_t compact(std::size_t count) {
+    assert(std::has_single_bit(count) && (count <= 16));
+    auto const ones = static_cast<std::uint16_t>((count >= 16) ? 0xffff : ((1u << count) - 1));
+
+    // Find the run storing the fewest pages.
+    std::size_t best = 16;
+    int best_used = 0;
+    for (std::size_t s = 0; s < 16; s += count) {
+      auto const run = static_cast<std::uint16_t>(ones << s);
+      bool pinned = false;
+      for (auto f = s; f < s + count; ++f) { pinned |= frame_table()[f].is_pinned(); }
+      if (pinned) { continue; }
+
+      auto const used = std::popcount(static_cast<std::uint16_t>(run & ~free_map()));
+      if ((best == 16) || (used < best_used)) {
+        best = s;
+        best_used = used;
+      }
+    }
+    if (best == 16) { throw std::bad_alloc(); }
+
+    // Move the pages out of the run.
+    auto const run = static_cast<std::uint16_t>(ones << best);
+    for (auto f = static_cast<std::uint8_t>(best); f < best + count; ++f) {
+      if (free_map() & (1 << f)) { continue; }
+      auto const outside = static_cast<std::uint16_t>(free_map() & ~run);
+      if (outside != 0) {
+        migrate_frame(f, static_cast<std::uint8_t>(std::countr_zero(outside)));
+      } else {
+        evict(this, f);
+        free_map() |= static_cast<std::uint16_t>(1 << f);
+      }
+    }
+
+    compaction_statistics.compactions++;
+    return static_cast<std::uint8_t>(best);
+  }
+
+  /// Removes the frame `f` from the machine, moving the page it stores to a free frame or, if
+  /// there is none, swapping it out.
+  ///
+  /// Removing frames models the memory of a virtual machine being reclaimed by its host, as with a
+  /// balloon driver or memory hot-unplug. The frames that the kernel's heap may occupy cannot be
+  /// removed, and neither can the frames of large pages nor frames that are already removed; the
+  /// method throws `std::invalid_argument` in these cases. It throws `std::bad_alloc`, leaving the
+  /// frame in place, if its page cannot be swapped out.
+  void remove_frame(std::uint8_t f) {
+    auto const bit = static_cast<std::uint16_t>(1 << f);
+    auto& frame = frame_table()[f];
+    if ((f < max_kernel_frames) || (f >= 16) || (removed_frames & bit) || frame.is_pinned()) {
+      throw std::invalid_argument("frame cannot be removed");
+    }
+
+    if (!(free_map() & bit)) {
+      auto const available = static_cast<std::uint16_t>(free_map() & ~bit);
+      if (available != 0) {
+        migrate_frame(f, static_cast<std::uint8_t>(std::countr_zero(available)));
+        balloon_statistics.migrations++;
+      } else {
+        evict(this, f);
+        balloon_statistics.evictions++;
+      }
+    }
+
+    frame.reset();
+    frame.set_pinned(true);
+    free_map() &= static_cast<std::uint16_t>(~bit);
+    removed_frames |= bit;
+    balloon_statistics.removals++;
+    check_watermarks();
+  }
+
+  /// Gives the frame `f`, which has been removed with `remove_frame`, back to the machine.
+  void restore_frame(std::uint8_t f) {
+    auto const bit = static_cast<std::uint16_t>(1 << f);
+    if ((f >= 16) || !(removed_frames & bit)) {
+      throw std::invalid_argument("frame is not removed");
+    }
+    frame_table()[f].reset();
+    free_map() |= bit;
+    removed_frames &= static_cast<std::uint16_t>(~bit);
+    balloon_statistics.restorations++;
+  }
+
+  /// Returns the number of frames that have not been removed.
+  inline std::size_t online_frame_count() const {
+    return 16 - static_cast<std::size_t>(std::popcount(removed_frames));
+  }
+
+  /// Inflates the balloon by up to `count` frames and returns the number of frames removed.
+  ///
+  /// Free frames are taken first, from the highest ones. Then frames storing pages are taken,
+  /// favoring those that have not been referenced recently, as a balloon driver allocating memory
+  /// in the guest would. The balloon stops early if no other frame can be removed.
+  std::size_t inflate_balloon(std::size_t count) {
+    std::size_t n = 0;
+    for (; n < count; ++n) {
+      // Prefer a free frame, then a frame that was not referenced.
+      auto const* frame_table = this->frame_table();
+      int f = -1;
+      int rank = 3;
+      for (int s = 15; s >= static_cast<int>(max_kernel_frames); --s) {
+        if ((removed_frames & (1 << s)) || frame_table[s].is_pinned()) { continue; }
+        auto const r = (free_map() & (1 << s)) ? 0 : (frame_table[s].is_referenced() ? 2 : 1);
+        if (r < rank) { f = s; rank = r; }
+      }
+      if (f < 0) { break; }
+      try {
+        remove_frame(static_cast<std::uint8_t>(f));
+      } catch (std::bad_alloc const&) {
+        break;
+      }
+    }
+    return n;
+  }
+
+  /// Deflates the balloon by up to `count` frames and returns the number of frames given back.
+  std::size_t deflate_balloon(std::size_t count) {
+    std::size_t n = 0;
+    for (; (n < count) && (removed_frames != 0); ++n) {
+      restore_frame(static_cast<std::uint8_t>(std::countr_zero(removed_frames)));
+    }
+    return n;
+  }
+
+  /// Sets the number of frames of the machine to `count`, removing the frames from `count` onwards
+  /// and restoring those below, as memory hot-plug would.
+  ///
+  /// The method throws `std::invalid_argument` if `count` is less than `max_kernel_frames` or
+  /// greater than 16, and `std::bad_alloc` if some frame cannot be removed.
+  void set_frame_count(std::size_t count) {
+    if ((count < max_kernel_frames) || (count > 16)) {
+      throw std::invalid_argument("invalid frame count");
+    }
+    for (auto f = count; f < 16; ++f) {
+      if (!(removed_frames & (1 << f))) { remove_frame(static_cast<std::uint8_t>(f)); }
+    }
+    for (std::size_t f = 0; f < count; ++f) {
+      if (removed_frames & (1 << f)) { restore_frame(static_cast<std::uint8_t>(f)); }
+    }
+  }
+
+  /// Returns a pointer to the entry of the large page containing `va`, or `nullptr` if `va` is
+  /// not in a large page.
+  PageEntry* find_large_page(VirtualAddress va) {
+    if (!is_large_page_level(va, 1)) { return nullptr; }
+    auto const d = page_map()[va.raw >> 14];
+    if ((d == 0) || (d & 1)) { return nullptr; }
+    auto* pda = rebind<std::uint16_t>(main_memory + d) + ((va.raw >> shifts[0]) & 0x7);
+    return (*pda & 1) ? rebind<PageEntry>(pda) : nullptr;
+  }
+
+  /// Replaces the mappings of the 8 pages from `va` by a large page, which is stored in an aligned
+  /// run of 8 frames and mapped by a single entry at *L1* (see `translate`), and returns `true`.
+  ///
+  /// `va` must be aligned on the size of a large page (2KB) and below the kernel's address space.
+  /// The method returns `false`, leaving the machine unchanged, unless every page in the range is
+  /// mapped, not backed by a file, and has the same protection. Pages that are not present are
+  /// swapped in. The frames of the run are freed with `compact`.
+  ///
+  /// The frames storing a large page are pinned: a large page is never swapped out, although it
+  /// can be split to let its pages be swapped out separately (see `split_large_page`). The method
+  /// throws `std::bad_alloc` if no run can be freed or if a page cannot be swapped in, in which
+  /// case the mappings are unchanged but some pages may have moved.
+  bool collapse_large_page(VirtualAddress va) {
+    if (((va.raw & 0x7ff) != 0) || (va.raw >= kernel_lower_bound)) {
+      throw std::invalid_argument("invalid large page");
+    }
+
+    // Check that all the pages in the range can be collapsed.
+    auto const d = page_map()[va.raw >> 14];
+    if ((d == 0) || (d & 1)) { return false; }
+    auto* pda = rebind<std::uint16_t>(main_memory + d) + ((va.raw >> shifts[0]) & 0x7);
+    if ((*pda == 0) || (*pda & 1)) { return false; }
+
+    auto* entries = rebind<PageEntry>(main_memory + *pda);
+    auto const protection = entries[0].protection();
+    for (std::size_t i = 0; i < 8; ++i) {
+      auto const& e = entries[i];
+      if (e.is_none() || e.is_guard() || e.is_file_backed() || (e.protection() != protection)) {
+        return false;
       }
+    }
+
+    // Reserve a run of frames, pinning them so that they are not chosen to swap pages in.
+    auto* frame_table = this->frame_table();
+    auto const base = compact(8);
+    free_map() &= static_cast<std::uint16_t>(~(0xff << base));
+    for (std::size_t i = 0; i < 8; ++i) {
+      frame_table[base + i].reset();
+      frame_table[base + i].set_pinned(true);
+    }
+
+    // Move each page to its frame in the run.
+    std::size_t i = 0;
+    try {
+      for (; i < 8; ++i) {
+        auto& pte = entries[i];
+        if (!pte.is_present()) {
+          translate_with_entry(va.advanced(static_cast<std::uint16_t>(i << 8)), 0, pte, false);
+        }
 
-      if (!foundOne) {                                  // If didn't find one, just try the next page
-        resultVirtualAddress = resultVirtualAddress.advanced(256);
-         // explained by a friend :
-        // If it goes back to the hint address, then there is no space available
-        if (resultVirtualAddress.raw == startingPoint.raw) {
-          throw std::bad_alloc();
+        auto const from = static_cast<std::uint8_t>(pte.frame());
+        auto const to = static_cast<std::uint8_t>(base + i);
+        std::copy_n(main_memory + (from << 8), 256, main_memory + (to << 8));
+        tlb.invalidate(pte.raw);
+        frame_table[from].reset();
+        free_map() |= static_cast<std::uint16_t>(1 << from);
+        pte.set_frame(to);
+        frame_table[to].add_back_reference(pte_offset(&pte));
+      }
+    } catch (std::bad_alloc const&) {
+      // Release the run, leaving the pages that have been moved there as regular pages.
+      for (std::size_t j = 0; j < 8; ++j) {
+        auto& frame = frame_table[base + j];
+        frame.set_pinned(false);
+        if (j >= i) {
+          frame.reset();
+          free_map() |= static_cast<std::uint16_t>(1 << (base + j));
         }
       }
+      throw;
     }
 
-    // Don't even need this part.
-    //if (!foundOne || resultVirtualAddress.raw >= 0xf800) { throw std::bad_alloc(); } // Truely the worst
+    // Replace the directory of the pages by the entry of the large page.
+    auto const directory = *pda;
+    shadow_invalidate(va, 8);
+    PageEntry large;
+    large.set_present(true);
+    large.set_protection(protection);
+    large.set_frame(base);
+    *pda = large.raw;
+    for (std::size_t j = 0; j < 8; ++j) {
+      auto& frame = frame_table[base + j];
+      frame.clear_back_references();
+      frame.add_back_reference(pte_offset(rebind<PageEntry>(pda)));
+      frame.set_referenced(true);
+    }
+    kfree(directory, 16);
+
+    compaction_statistics.collapses++;
+    return true;
+  }
 
-    // Finally allocate all the pages legally.
-    for (std::size_t i = 0; i < nbrPages; ++i) {
-      allocate_page(resultVirtualAddress.advanced(i * 256), protection);
+  /// Replaces the large page containing `va`, if any, by the mappings of the 8 pages it contains,
+  /// which remain stored in the same frames.
+  ///
+  /// The frames of the large page are unpinned. The method throws `std::bad_alloc` if the kernel's
+  /// heap cannot store a new directory, in which case the large page is unchanged.
+  void split_large_page(VirtualAddress va) {
+    auto* pte = find_large_page(va);
+    if (pte == nullptr) { return; }
+
+    auto const large = *pte;
+    auto const offset = kalloc(16);
+    auto* entries = rebind<PageEntry>(main_memory + offset);
+    for (std::size_t i = 0; i < 8; ++i) {
+      auto const f = static_cast<std::uint8_t>(large.frame() + i);
+      auto& frame = frame_table()[f];
+      entries[i] = large;
+      entries[i].set_frame(f);
+      frame.clear_back_references();
+      frame.set_pinned(false);
+      frame.add_back_reference(pte_offset(entries + i));
     }
+    pte->raw = offset;
+    shadow_invalidate(VirtualAddress{static_cast<std::uint16_t>(va.raw & ~0x7ff)}, 8);
+    compaction_statistics.splits++;
+  }
 
-    return resultVirtualAddress;
-  };
-  // Yippee the end.
+  /// Collapses the ranges of pages that can be mapped by large pages (see `collapse_large_page`),
+  /// stopping at the first one for which no run of frames can be freed, and returns the number of
+  /// large pages created.
+  ///
+  /// This method plays the role of Linux's khugepaged, which scans address spaces in the
+  /// background to recover large pages once memory has been fragmented.
+  std::size_t khugepaged() {
+    std::size_t n = 0;
+    try {
+      for (std::uint32_t a = 0; a < kernel_lower_bound; a += 0x800) {
+        if (collapse_large_page(static_cast<std::uint16_t>(a))) { ++n; }
+      }
+    } catch (std::bad_alloc const&) {
+      // No run of frames can be freed.
+    }
+    return n;
+  }
 
 
 
@@ -913,40 +2289,30 @@ struct Machine {
   static void allocate_on_segfault(
     Machine* self, VirtualAddress va, PageEntry::Protection ps, std::uint16_t* pda, std::size_t i
   ) {
-    assert(*pda == 0);
-
-    // Look for a free slot in main memory.
-    auto* frame_table = self->frame_table();
-    auto& free_map = self->free_map();
-    std::uint8_t free_slot = std::countr_zero(free_map);
-
-    // All frames are busy; swapping required.
-    if (free_slot >= 16) {
-      assert(free_map == 0);
-
-      // Find slot in secondary memory to swap out the victim.
-      auto* next_region = rebind<RegionPointer>(self->secondary_memory);
-      if (next_region->length() == 0) {
-        throw std::bad_alloc();
-      }
-      free_slot = swap_victim(self, next_region->offset());
+    // Update the translation table first so that a failure to allocate a directory does not leak
+    // a frame. Directories that have been linked remain valid if frame allocation fails.
+    auto* pte = link_entry(self, va, pda, i);
+    auto const free_slot = acquire_frame(self, va);
 
-      // Zero-initialize the fresh frame.
-      std::fill_n(self->main_memory + (free_slot << 8), 256, std::byte{0});
+    // Zero-initialize the fresh frame, which may have been used by a page that got unmapped.
+    std::fill_n(self->main_memory + (free_slot << 8), 256, std::byte{0});
+    self->frame_table()[free_slot].set_referenced(true);
 
-      // Update the free list of secondary memory.
-      next_region->offset() += 1;
-      next_region->length() -= 1;
-    }
-
-    // Update the frame table.
-    frame_table[free_slot].reset();
-    frame_table[free_slot].set_referenced(true);
-
-    // Update the free map.
-    free_map = free_map & ~(1 << free_slot);
+    // Write the page entry.
+    *pte = PageEntry{};
+    pte->set_present(true);
+    pte->set_protection(ps);
+    pte->set_frame(free_slot);
+    self->frame_table()[free_slot].add_back_reference(self->pte_offset(pte));
+    self->shadow_fill(va, pte, false);
+  }
 
-    // Update the translation table.
+  /// Allocates the directories on the path to the entry of `va`, given that `pda` is the null
+  /// entry found at the `i`-th level of the translation table, and returns the entry of `va`.
+  static PageEntry* link_entry(
+    Machine* self, VirtualAddress va, std::uint16_t* pda, std::size_t i
+  ) {
+    assert(*pda == 0);
     PageEntry* pte = nullptr;
     auto* m = self->main_memory;
 
@@ -956,19 +2322,210 @@ struct Machine {
       auto offset = self->kalloc(16);
       pte = rebind<PageEntry>(m + offset) + ((va.raw >> shifts[1]) & 0x7);
       if (i == 0) {
-        auto o = self->kalloc(16);
+        std::uint16_t o = 0;
+        try {
+          o = self->kalloc(16);
+        } catch (std::bad_alloc const&) {
+          self->kfree(offset, 16);
+          throw;
+        }
         rebind<std::uint16_t>(m + o)[(va.raw >> shifts[0]) & 0x7] = offset;
         offset = o;
       }
 
       *pda = offset;
     }
+    return pte;
+  }
 
-    *pte = PageEntry{};
-    pte->set_present(true);
-    pte->set_protection(ps);
-    pte->set_frame(free_slot);
-    frame_table[free_slot].add_back_reference(self->pte_offset(pte));
+  /// Returns the index of a frame that is not storing any page, to store the page containing
+  /// `va`, evicting a victim if all frames are busy.
+  ///
+  /// The free frame is chosen by `frame_policy`. The descriptor of the returned frame is reset and
+  /// the frame is marked used in `free_map`. Its contents is unspecified.
+  static std::uint8_t acquire_frame(Machine* self, VirtualAddress va) {
+    auto& free_map = self->free_map();
+    std::uint8_t f = 0;
+
+    // All frames are busy; swapping required.
+    if (free_map == 0) {
+      f = find_victim(self);
+      evict(self, f);
+      self->reclaim_statistics.direct++;
+    } else {
+      f = self->frame_policy.select(free_map, va.raw >> 8, self->core);
+      free_map = free_map & ~(1 << f);
+    }
+    self->check_watermarks();
+
+    self->frame_table()[f].reset();
+    return f;
+  }
+
+  /// Moves the page stored in frame `f` out of main memory and resets the descriptor of `f`.
+  ///
+  /// A page of a file is written back to its file if it has been modified. Any other page is
+  /// swapped out to the next available slot of secondary memory. The method throws
+  /// `std::bad_alloc`, leaving the machine unchanged, if there is no such slot.
+  static void evict(Machine* self, std::uint8_t f) {
+    auto& frame = self->frame_table()[f];
+    assert(!frame.is_pinned());
+
+    if (auto const id = frame.permanent_position(); id != 0) {
+      self->write_back(id);
+      self->page_cache[id - 1].frame = 0xff;
+      update_page_entries_after_swap(self, f, id);
+    } else if (self->swap_devices.is_enabled()) {
+      auto const slot = self->swap_devices.allocate();
+      if (!slot) { throw std::bad_alloc(); }
+      self->store_slot(*slot, self->main_memory + (f << 8));
+      update_page_entries_after_swap(self, f, *slot);
+    } else {
+      auto* next_region = rebind<RegionPointer>(self->secondary_memory);
+      if (next_region->length() == 0) { throw std::bad_alloc(); }
+
+      auto const slot = next_region->offset();
+      self->store_slot(slot, self->main_memory + (f << 8));
+      update_page_entries_after_swap(self, f, slot);
+      next_region->offset() += 1;
+      next_region->length() -= 1;
+    }
+    frame.reset();
+  }
+
+  /// Moves the page containing `va`, which is stored at `secondary_slot`, into main memory and
+  /// returns the index of the frame in which it has been written.
+  ///
+  /// If there is a free frame, the page is copied to the frame chosen by `frame_policy` and
+  /// `secondary_slot` is released (see `release_slot`). Otherwise, the page is swapped with a
+  /// victim (see `swap_victim`).
+  static std::uint8_t swap_in(Machine* self, VirtualAddress va, std::uint16_t secondary_slot) {
+    auto& free_map = self->free_map();
+    if (free_map == 0) {
+      self->reclaim_statistics.direct++;
+      auto const f = swap_victim(self, secondary_slot);
+      self->check_watermarks();
+      return f;
+    }
+
+    auto const f = self->frame_policy.select(free_map, va.raw >> 8, self->core);
+    self->load_slot(secondary_slot, self->main_memory + (f << 8));
+    self->release_slot(secondary_slot);
+    self->frame_table()[f].reset();
+    free_map = free_map & ~(1 << f);
+    self->check_watermarks();
+    return f;
+  }
+
+  /// Reads the page stored at `slot` into `page`, from the compressed pool or secondary memory.
+  void load_slot(std::uint16_t slot, std::byte* page) {
+    auto const hits = compressed_pool.statistics.pool_hits;
+    compressed_pool.load(slot, page, secondary_memory);
+    if (compressed_pool.statistics.pool_hits != hits) {
+      charge(Event::pool_read);
+    } else {
+      charge_transfer(slot, Event::swap_read);
+    }
+  }
+
+  /// Writes `page` at `slot`, in the compressed pool or secondary memory.
+  void store_slot(std::uint16_t slot, std::byte const* page) {
+    auto const stores = compressed_pool.statistics.stores;
+    compressed_pool.store(slot, page, secondary_memory);
+    if (compressed_pool.statistics.stores != stores) {
+      charge(Event::pool_write);
+      for (auto s : compressed_pool.spilled_slots) { charge_transfer(s, Event::swap_write); }
+    } else {
+      charge_transfer(slot, Event::swap_write);
+    }
+  }
+
+  /// Releases `slot`, whose page has been swapped in or unmapped.
+  ///
+  /// The slot is released to its swap device, if devices are in use, so that it can be allocated
+  /// again. The default region of secondary memory never reuses its slots.
+  void release_slot(std::uint16_t slot) {
+    compressed_pool.discard(slot);
+    if (swap_devices.is_enabled()) { swap_devices.release(slot); }
+  }
+
+  /// Adds a swap device of `count` slots with the given `priority`, `latency` in cycles, and
+  /// `bandwidth` in bytes per cycle, and returns its index in `swap_devices.devices` (see
+  /// `SwapDevices::add`).
+  ///
+  /// The method throws `std::invalid_argument` if there are not enough slots left or if a page has
+  /// already been swapped out to the default region of secondary memory, whose slots the devices
+  /// would allocate again.
+  std::size_t add_swap_device(
+    int priority, std::uint16_t count, std::uint64_t latency, double bandwidth
+  ) {
+    if (rebind<RegionPointer>(secondary_memory)->offset() != 1) {
+      throw std::invalid_argument("secondary memory is already in use");
+    }
+    return swap_devices.add(priority, count, latency, bandwidth);
+  }
+
+  /// Adds the cost of `e`, which is a transfer of the page at `slot` to or from secondary memory,
+  /// to the latency of the current access, using the cost of the device holding `slot`, if any.
+  void charge_transfer(std::uint16_t slot, Event e) {
+    auto* device = swap_devices.device_of(slot);
+    if (device == nullptr) { return charge(e); }
+    ((e == Event::swap_write) ? device->statistics.writes : device->statistics.reads)++;
+    device->statistics.cycles += device->cost();
+    charge(e, device->cost());
+  }
+
+  /// Adds the cost of a fault raised by an access to `va` to the latency of the current access.
+  inline void charge_fault(VirtualAddress va) {
+    charge(Event::fault);
+    heatmap.record_fault(static_cast<std::uint8_t>(va.raw >> 8));
+  }
+
+  /// Adds the cost of `e` to the latency of the current access.
+  inline void charge(Event e) {
+    charge(e, cost_model[e]);
+  }
+
+  /// Adds an occurrence of `e` costing `c` cycles to the latency of the current access.
+  inline void charge(Event e, std::uint64_t c) {
+    if (kswapd_running) {
+      reclaim_statistics.background_cycles += c;
+    } else {
+      latency.charge(e, c);
+    }
+  }
+
+  /// Returns the number of free frames.
+  inline std::size_t free_frame_count() {
+    return static_cast<std::size_t>(std::popcount(free_map()));
+  }
+
+  /// Wakes the reclaim daemon up if the number of free frames is below the low watermark.
+  inline void check_watermarks() {
+    if (free_frame_count() < watermarks.low) { kswapd_pending = true; }
+  }
+
+  /// Runs the reclaim daemon, which evicts cold pages until the number of free frames reaches the
+  /// high watermark.
+  ///
+  /// The daemon stops early if no page can be evicted (e.g., if secondary memory is full). Its
+  /// cost is accumulated in `reclaim_statistics` rather than charged to the current access.
+  void kswapd() {
+    kswapd_pending = false;
+    kswapd_running = true;
+    reclaim_statistics.wakeups++;
+
+    try {
+      while (free_frame_count() < watermarks.high) {
+        auto const f = find_victim(this);
+        evict(this, f);
+        free_map() |= static_cast<std::uint16_t>(1 << f);
+        reclaim_statistics.background++;
+      }
+    } catch (std::bad_alloc const&) {
+      // Nothing left to reclaim.
+    }
+    kswapd_running = false;
   }
 
   /// Selects a page to evict, swaps its contents to secondary memory, and returns the index of the
@@ -979,10 +2536,25 @@ struct Machine {
     // Look for a "victim", i.e., a frame not referenced since the last stealing pass.
     auto victim = find_victim(self);
 
-    // Swap data.
-    auto* p = rebind<std::uint32_t>(self->secondary_memory + (secondary_slot << 8));
-    auto* q = rebind<std::uint32_t>(self->main_memory + (victim << 8));
-    for (auto i = 0; i < 64; ++i) { std::swap(p[i], q[i]); }
+    // A page of a file is written back rather than swapped. With swap devices, the victim goes to
+    // a slot of the device of highest priority rather than to `secondary_slot`, which is released
+    // first so that it can receive the victim if its device has that priority.
+    auto const backed_by_file = self->frame_table()[victim].permanent_position() != 0;
+    if (backed_by_file || self->swap_devices.is_enabled()) {
+      std::byte incoming[256];
+      self->load_slot(secondary_slot, incoming);
+      self->release_slot(secondary_slot);
+      evict(self, victim);
+      std::copy_n(incoming, 256, self->main_memory + (victim << 8));
+      return victim;
+    }
+
+    // Swap data, going through the compressed pool.
+    auto* frame = self->main_memory + (victim << 8);
+    std::byte incoming[256];
+    self->load_slot(secondary_slot, incoming);
+    self->store_slot(secondary_slot, frame);
+    std::copy_n(incoming, 256, frame);
 
     update_page_entries_after_swap(self, victim, secondary_slot);
     return victim;
@@ -994,8 +2566,10 @@ struct Machine {
     std::uint8_t victim = 0xff;
 
     // Look for a "victim", i.e., a frame not referenced since the last stealing pass, favoring
-    // candidates with fewer back references.
+    // candidates with fewer back references. Free frames store no page and are skipped.
+    auto const free_map = self->free_map();
     for (std::uint8_t s = 0; s < 16; ++s) {
+      if (free_map & (1 << s)) { continue; }
       if (frame_table[s].is_ready_for_eviction()) {
         auto const n = frame_table[s].back_reference_count();
         if (n == 0) {
@@ -1031,9 +2605,13 @@ struct Machine {
 
   /// Update the page table entries that are currently referring to `victim`, which is the index of
   /// the frame containing a page whose contents has been swapped out to `secondary_slot`.
+  ///
+  /// If the page is backed by a file, `secondary_slot` is the identifier of the page in the page
+  /// cache.
   static void update_page_entries_after_swap(
     Machine* self, std::uint8_t victim, std::uint16_t secondary_slot
   ) {
+    self->heatmap.record_eviction(victim);
     auto& frame = self->frame_table()[victim];
     auto const n = frame.back_reference_count();
     if (n > 2) {
@@ -1042,10 +2620,10 @@ struct Machine {
     }
 
     for (auto i = 0; i < n; ++i) {
-      auto& pte = *rebind<PageEntry>(self->main_memory + frame.back_references()[i]);
+      auto& pte = *rebind<PageEntry>(self->main_memory + frame.back_reference(i));
       assert(pte.is_present());
 
-      self->tlb.invalidate(pte);
+      self->tlb.invalidate(pte.raw);
 
       // Unset the present bit and re-map
       pte.set_present(false);
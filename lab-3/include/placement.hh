@@ -0,0 +1,169 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mmu {
+
+/// The policy used to choose a frame among the free frames of main memory.
+///
+/// The policy only applies when a free frame exists. Otherwise, a victim is evicted regardless of
+/// the policy (see `Machine::acquire_frame`). The following policies are supported:
+///
+/// - `lowest` picks the free frame with the lowest index;
+/// - `coloring` picks a free frame whose color matches that of the page being mapped, so that
+///   consecutive pages are spread across the sets of a physically indexed cache;
+/// - `numa` picks a free frame on the node of the core mapping the page, falling back to the
+///   nearest nodes if that node has no free frame; and
+/// - `interleave` picks a free frame on each node in turn, also falling back to the nearest
+///   nodes.
+///
+/// Frames are divided among nodes in contiguous blocks of equal size. A core is attached to the
+/// node whose index is the core's index modulo the number of nodes.
+struct FrameAllocationPolicy {
+
+  /// The number of frames in main memory.
+  static constexpr std::size_t frame_count = 16;
+
+  /// A kind of policy.
+  enum class Kind : std::uint8_t { lowest, coloring, numa, interleave };
+
+  /// Statistics about frame allocation.
+  struct Statistics {
+
+    /// The number of frames allocated on each node.
+    std::vector<std::size_t> allocations;
+
+    /// The number of frames allocated on another node than the one of the requesting core.
+    std::size_t remote_allocations = 0;
+
+    /// The number of frames whose color matched that of their page.
+    std::size_t color_hits = 0;
+
+    /// The number of frames whose color did not match that of their page.
+    std::size_t color_misses = 0;
+
+  };
+
+  /// The kind of this policy.
+  Kind kind = Kind::lowest;
+
+  /// The number of page colors.
+  ///
+  /// The color of a frame (resp. page) is its index (resp. page number) modulo this number. For a
+  /// physically indexed cache, the number of colors should be the size of a way divided by the
+  /// size of a page (see `color_count_of`).
+  std::size_t color_count = 1;
+
+  /// The number of NUMA nodes, which must divide the number of frames.
+  std::size_t node_count = 1;
+
+  /// The distance between each pair of nodes, as a `node_count` by `node_count` matrix in
+  /// row-major order, or an empty vector to use a distance of 10 locally and 20 otherwise.
+  std::vector<std::uint32_t> distances;
+
+  /// The node on which `interleave` allocates the next frame.
+  std::size_t next_node = 0;
+
+  /// Statistics about frame allocation.
+  Statistics statistics;
+
+  /// Returns the number of colors of a cache whose ways contain `way_size` bytes, given pages of
+  /// `page_size` bytes.
+  static constexpr std::size_t color_count_of(std::size_t way_size, std::size_t page_size = 256) {
+    return (way_size <= page_size) ? 1 : way_size / page_size;
+  }
+
+  /// Returns the node of frame `f`.
+  inline std::size_t node_of_frame(std::size_t f) const {
+    return f / (frame_count / node_count);
+  }
+
+  /// Returns the node of core `c`.
+  inline std::size_t node_of_core(std::size_t c) const {
+    return c % node_count;
+  }
+
+  /// Returns the distance between nodes `a` and `b`.
+  inline std::uint32_t distance(std::size_t a, std::size_t b) const {
+    if (distances.empty()) { return (a == b) ? 10 : 20; }
+    return distances[a * node_count + b];
+  }
+
+  /// Returns the mask of the frames on node `n` in a free map.
+  inline std::uint16_t node_mask(std::size_t n) const {
+    auto const k = frame_count / node_count;
+    auto const ones = static_cast<std::uint16_t>((k >= 16) ? 0xffff : ((1u << k) - 1));
+    return static_cast<std::uint16_t>(ones << (n * k));
+  }
+
+  /// Returns the index of a free frame to store the page with the given page number on behalf of
+  /// `core`, given the map `free_map` of the free frames, which must not be empty.
+  std::uint8_t select(std::uint16_t free_map, std::size_t page_number, std::size_t core) {
+    assert(free_map != 0);
+    assert((node_count > 0) && (frame_count % node_count == 0));
+    if (statistics.allocations.size() != node_count) { statistics.allocations.resize(node_count); }
+
+    std::uint8_t f = 0;
+    switch (kind) {
+      case Kind::lowest:
+        f = lowest(free_map);
+        break;
+
+      case Kind::coloring: {
+        // Look for the lowest free frame of the right color.
+        std::uint16_t colored = 0;
+        for (std::size_t i = page_number % color_count; i < frame_count; i += color_count) {
+          colored |= static_cast<std::uint16_t>(1u << i);
+        }
+        auto const matching = static_cast<std::uint16_t>(free_map & colored);
+        f = lowest((matching != 0) ? matching : free_map);
+        ((matching != 0) ? statistics.color_hits : statistics.color_misses)++;
+        break;
+      }
+
+      case Kind::numa:
+        f = nearest(free_map, node_of_core(core));
+        break;
+
+      case Kind::interleave:
+        f = nearest(free_map, next_node);
+        next_node = (next_node + 1) % node_count;
+        break;
+    }
+
+    auto const n = node_of_frame(f);
+    statistics.allocations[n]++;
+    if (n != node_of_core(core)) { statistics.remote_allocations++; }
+    return f;
+  }
+
+private:
+
+  /// Returns the lowest frame in `free_map`, which must not be empty.
+  static std::uint8_t lowest(std::uint16_t free_map) {
+    return static_cast<std::uint8_t>(std::countr_zero(free_map));
+  }
+
+  /// Returns the lowest free frame on the node nearest to `home` having a free frame.
+  std::uint8_t nearest(std::uint16_t free_map, std::size_t home) const {
+    std::size_t best = node_count;
+    for (std::size_t n = 0; n < node_count; ++n) {
+      if ((free_map & node_mask(n)) == 0) { continue; }
+      if ((best == node_count) || (distance(home, n) < distance(home, best))
+        || ((distance(home, n) == distance(home, best)) && (n == home)))
+      {
+        best = n;
+      }
+    }
+    assert(best < node_count);
+    return lowest(static_cast<std::uint16_t>(free_map & node_mask(best)));
+  }
+
+};
+
+} // namespace mmu
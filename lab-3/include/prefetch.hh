@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <vector>
+
+namespace mmu {
+
+/// A prefetcher predicting the pages whose translations should be inserted in the TLB before they
+/// are accessed.
+///
+/// The prefetcher tracks a few access streams, each described by the last page it missed and the
+/// stride between its last two misses, in pages. A TLB miss is attributed to the stream whose last
+/// page is the nearest within `window` pages, or starts a new stream replacing the least recently
+/// used one. Once a stream has missed twice with the same stride, each of its misses predicts the
+/// next `depth` pages along that stride.
+///
+/// A hit on a prefetched translation is counted as useful and advances its stream, so that a
+/// sequential scan keeps running ahead of its accesses. A prefetched translation that leaves the
+/// TLB before being used is counted as wasted. The prefetcher is disabled if `depth` is zero.
+struct TLBPrefetcher {
+
+  /// A sequence of accesses with a constant stride.
+  struct Stream {
+
+    /// The page number of the last page accessed by the stream.
+    std::int32_t last_page = 0;
+
+    /// The difference between the page numbers of the last two accesses of the stream.
+    std::int32_t stride = 0;
+
+    /// The number of consecutive accesses that confirmed `stride`.
+    std::uint8_t confidence = 0;
+
+    /// The time of the last access of the stream, used to replace streams in LRU order.
+    std::uint64_t last_use = 0;
+
+    /// `true` iff the stream has been started.
+    bool valid = false;
+
+  };
+
+  /// A translation inserted in the TLB by the prefetcher that has not been used yet.
+  struct Pending {
+
+    /// The page number of the translation.
+    std::int32_t page;
+
+    /// The index of the stream on behalf of which the translation was prefetched.
+    std::size_t stream;
+
+  };
+
+  /// A prediction made by the prefetcher.
+  struct Prediction {
+
+    /// The stride along which pages should be prefetched, or 0 if no page should be.
+    std::int32_t stride;
+
+    /// The index of the stream that made the prediction.
+    std::size_t stream;
+
+  };
+
+  /// Statistics about the prefetcher.
+  struct Statistics {
+
+    /// The number of TLB misses observed by the prefetcher.
+    std::size_t demand_misses = 0;
+
+    /// The number of speculative page walks.
+    std::size_t walks = 0;
+
+    /// The number of translations inserted in the TLB.
+    std::size_t prefetches = 0;
+
+    /// The number of prefetched translations that were used.
+    std::size_t useful = 0;
+
+    /// The number of prefetched translations that left the TLB before being used.
+    std::size_t wasted = 0;
+
+    /// Returns the fraction of prefetched translations that were used, or 0 if there was none.
+    inline double accuracy() const {
+      return (prefetches == 0) ? 0.0 : static_cast<double>(useful) / prefetches;
+    }
+
+  };
+
+  /// The number of pages prefetched ahead of a stream, or 0 if the prefetcher is disabled.
+  std::size_t depth = 0;
+
+  /// The number of streams tracked by the prefetcher.
+  std::size_t stream_count = 4;
+
+  /// The maximum distance, in pages, between a miss and the last page of its stream.
+  std::int32_t window = 4;
+
+  /// The streams tracked by the prefetcher.
+  std::vector<Stream> streams;
+
+  /// The prefetched translations that have not been used yet.
+  std::vector<Pending> pending;
+
+  /// The number of events observed so far, used as a clock for LRU replacement.
+  std::uint64_t clock = 0;
+
+  /// Statistics about the prefetcher.
+  Statistics statistics;
+
+  /// Returns `true` iff the prefetcher is enabled.
+  inline bool is_enabled() const {
+    return depth != 0;
+  }
+
+  /// Records a TLB miss on the page whose number is `page` and returns the resulting prediction.
+  Prediction train(std::int32_t page) {
+    if (streams.size() != stream_count) { streams.resize(stream_count); }
+    statistics.demand_misses++;
+    ++clock;
+
+    // Find the stream nearest to the page, if any.
+    std::size_t s = stream_count;
+    for (std::size_t i = 0; i < stream_count; ++i) {
+      if (!streams[i].valid) { continue; }
+      auto const d = std::abs(page - streams[i].last_page);
+      if ((d <= window) && ((s == stream_count) || (d < std::abs(page - streams[s].last_page)))) {
+        s = i;
+      }
+    }
+
+    // Start a new stream if the miss does not belong to any.
+    if (s == stream_count) {
+      auto const lru = std::min_element(streams.begin(), streams.end(), [](auto& a, auto& b) {
+        return (a.valid ? a.last_use + 1 : 0) < (b.valid ? b.last_use + 1 : 0);
+      });
+      *lru = {page, 0, 0, clock, true};
+      return {0, static_cast<std::size_t>(lru - streams.begin())};
+    }
+
+    // Update the stride of the stream.
+    auto& stream = streams[s];
+    auto const stride = page - stream.last_page;
+    if (stride != 0) {
+      if (stride == stream.stride) {
+        stream.confidence = static_cast<std::uint8_t>(std::min(stream.confidence + 1, 3));
+      } else {
+        stream.stride = stride;
+        stream.confidence = 0;
+      }
+      stream.last_page = page;
+    }
+    stream.last_use = clock;
+    return {(stream.confidence > 0) ? stream.stride : 0, s};
+  }
+
+  /// Records that the translation of `page` has been prefetched on behalf of `stream`.
+  void issue(std::int32_t page, std::size_t stream) {
+    pending.push_back({page, stream});
+    statistics.prefetches++;
+  }
+
+  /// Records a TLB hit on the page whose number is `page` and returns the prediction of the
+  /// stream that prefetched its translation, if any.
+  std::optional<Prediction> consume(std::int32_t page) {
+    auto const p = std::find_if(pending.begin(), pending.end(), [&](auto const& e) {
+      return e.page == page;
+    });
+    if (p == pending.end()) { return std::nullopt; }
+
+    auto const s = p->stream;
+    pending.erase(p);
+    statistics.useful++;
+
+    // Advance the stream past the page.
+    auto& stream = streams[s];
+    stream.last_page = page;
+    stream.last_use = ++clock;
+    return Prediction{stream.stride, s};
+  }
+
+  /// Removes the pending translations of the pages for which `is_cached` returns `false`, which
+  /// have left the TLB without being used.
+  template<typename F>
+  void retire(F&& is_cached) {
+    auto const n = pending.size();
+    std::erase_if(pending, [&](auto const& e) { return !is_cached(e.page); });
+    statistics.wasted += n - pending.size();
+  }
+
+};
+
+} // namespace mmu
@@ -0,0 +1,608 @@
+#pragma once
+
+#include "bitmap.hh"
+#include "mmu.hh"
+#include "tlb.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+namespace mmu {
+
+/// The geometry of a virtual address space.
+///
+/// Addresses are represented by unsigned integers of type `Address`. The space is divided in pages
+/// of `2^page_bits` bytes, mapped by a radix page translation table whose `i`-th level is indexed
+/// by `level_bits[i]` bits of an address, from the most significant bits of the address down to
+/// the offset in the page. For example, the address space of `Machine` is described as follows:
+///
+///     ┌───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┬───┐
+///     │ f │ e │ d │ c │ b │ a │ 9 │ 8 │ 7 │ 6 │ 5 │ 4 │ 3 │ 2 │ 1 │ 0 │
+///     ╞═══╧═══╪═══╧═══╧═══╪═══╧═══╧═══╪═══╧═══╧═══╧═══╧═══╧═══╧═══╧═══╡
+///     │ 2     │ 3         │ 3         │ 8                             │
+///     └───────┴───────────┴───────────┴───────────────────────────────┘
+///
+/// which corresponds to `Geometry<std::uint16_t, 8, 2, 3, 3>`.
+template<typename Address, unsigned page_bits, unsigned... level_bits>
+struct Geometry {
+
+  /// The type of an address.
+  using address_type = Address;
+
+  /// The number of levels in the page translation table.
+  static constexpr std::size_t level_count = sizeof...(level_bits);
+
+  /// The number of bits indexing each level of the page translation table.
+  static constexpr std::array<unsigned, level_count> bits = {level_bits...};
+
+  /// The number of bits of an address denoting an offset in a page.
+  static constexpr unsigned page_shift = page_bits;
+
+  /// The number of significant bits in an address.
+  static constexpr unsigned address_bits = (page_bits + ... + level_bits);
+
+  static_assert(level_count > 0);
+  static_assert(address_bits <= 8 * sizeof(Address) && address_bits < 64);
+
+  /// The size of a page.
+  static constexpr Address page_size = Address{1} << page_bits;
+
+  /// The number of addresses in the space.
+  static constexpr std::uint64_t size = std::uint64_t{1} << address_bits;
+
+  /// Returns the number of bits by which an address should be shifted to the right to read the
+  /// index of the `i`-th level.
+  static constexpr unsigned shift(std::size_t i) {
+    unsigned s = page_bits;
+    for (auto j = i + 1; j < level_count; ++j) { s += bits[j]; }
+    return s;
+  }
+
+  /// Returns the number of entries in a directory of the `i`-th level.
+  static constexpr std::size_t fanout(std::size_t i) {
+    return std::size_t{1} << bits[i];
+  }
+
+  /// Returns the index of `va` in a directory of the `i`-th level.
+  static constexpr std::size_t index(Address va, std::size_t i) {
+    return static_cast<std::size_t>(va >> shift(i)) & (fanout(i) - 1);
+  }
+
+  /// Returns the address of the page containing `va`.
+  static constexpr Address page(Address va) {
+    return va & ~(page_size - 1);
+  }
+
+  /// Returns the offset of `va` in its page.
+  static constexpr Address offset(Address va) {
+    return va & (page_size - 1);
+  }
+
+};
+
+/// A 32-bit address space with 4KB pages and a two-level table.
+using Geometry32 = Geometry<std::uint32_t, 12, 10, 10>;
+
+/// A 48-bit address space with 4KB pages and a four-level table.
+using Geometry48 = Geometry<std::uint64_t, 12, 9, 9, 9, 9>;
+
+/// A page translation table organized as a radix tree whose shape is described by `G`.
+///
+/// Unlike the table of `Machine`, which is encoded in the machine's main memory, directories are
+/// allocated on the host. A directory at the last level is an array of page entries; a directory
+/// at any other level is an array of pointers to directories at the next level, where a null
+/// pointer denotes an unmapped region. Directories are allocated when the first page of their
+/// region is mapped and released when the last one is unmapped.
+template<typename G>
+struct RadixPageTable {
+
+  /// The type of an address.
+  using Address = typename G::address_type;
+
+  /// The type of a page entry.
+  using Entry = BasicPageEntry<std::uint64_t>;
+
+  /// The root directory.
+  void** root;
+
+  /// The number of bytes occupied by the directories.
+  std::size_t bytes = 0;
+
+  /// The number of directories visited by `find`.
+  std::uint64_t steps = 0;
+
+  /// Creates an empty table.
+  ///
+  /// The argument, which denotes the number of frames in main memory, is ignored. It is accepted
+  /// so that all tables can be created the same way (see `WideMachine`).
+  RadixPageTable(std::size_t = 0) : root(nullptr) {
+    root = static_cast<void**>(allocate(0));
+  }
+
+  RadixPageTable(RadixPageTable const&) = delete;
+
+  RadixPageTable& operator=(RadixPageTable const&) = delete;
+
+  ~RadixPageTable() {
+    release(root, 0);
+  }
+
+  /// Returns a pointer to the entry of the page containing `va`, or `nullptr` if that page is not
+  /// mapped.
+  Entry* find(Address va) {
+    void** d = root;
+    for (std::size_t i = 0; i + 1 < G::level_count; ++i) {
+      ++steps;
+      d = static_cast<void**>(d[G::index(va, i)]);
+      if (d == nullptr) { return nullptr; }
+    }
+    ++steps;
+
+    auto* e = rebind<Entry>(d) + G::index(va, G::level_count - 1);
+    return e->is_none() ? nullptr : e;
+  }
+
+  /// Maps the page containing `va` to `e`, allocating the directories on the path to its entry.
+  void assign(Address va, Entry e) {
+    assert(!e.is_none());
+    void** d = root;
+    for (std::size_t i = 0; i + 1 < G::level_count; ++i) {
+      auto& child = d[G::index(va, i)];
+      if (child == nullptr) { child = allocate(i + 1); }
+      d = static_cast<void**>(child);
+    }
+    rebind<Entry>(d)[G::index(va, G::level_count - 1)] = e;
+  }
+
+  /// Removes the mapping of the page containing `va`, if any, releasing the directories that
+  /// become empty.
+  void erase(Address va) {
+    erase(root, 0, va);
+  }
+
+  /// Calls `action(page, e)` for each mapped page, where `page` is the address of the page and `e`
+  /// is its entry, in increasing order of addresses.
+  template<typename F>
+  void for_each(F&& action) {
+    for_each(root, 0, Address{0}, action);
+  }
+
+  /// Returns the number of bytes occupied by the table.
+  inline std::size_t footprint() const {
+    return bytes;
+  }
+
+private:
+
+  /// Returns the number of bytes occupied by a directory of the `i`-th level.
+  static constexpr std::size_t directory_size(std::size_t i) {
+    return G::fanout(i) * ((i + 1 < G::level_count) ? sizeof(void*) : sizeof(Entry));
+  }
+
+  /// Allocates an empty directory of the `i`-th level.
+  void* allocate(std::size_t i) {
+    bytes += directory_size(i);
+    if (i + 1 < G::level_count) {
+      return new void*[G::fanout(i)]();
+    } else {
+      return new Entry[G::fanout(i)]();
+    }
+  }
+
+  /// Releases `d`, which is a directory of the `i`-th level, and its children.
+  void release(void* d, std::size_t i) {
+    bytes -= directory_size(i);
+    if (i + 1 < G::level_count) {
+      auto** children = static_cast<void**>(d);
+      for (std::size_t j = 0; j < G::fanout(i); ++j) {
+        if (children[j] != nullptr) { release(children[j], i + 1); }
+      }
+      delete[] children;
+    } else {
+      delete[] static_cast<Entry*>(d);
+    }
+  }
+
+  /// Removes the mapping of `va` from `d`, which is a directory of the `i`-th level, returning
+  /// `true` iff `d` is empty after the removal.
+  bool erase(void* d, std::size_t i, Address va) {
+    if (i + 1 == G::level_count) {
+      auto* entries = static_cast<Entry*>(d);
+      entries[G::index(va, i)] = Entry{};
+      return std::all_of(entries, entries + G::fanout(i), [](auto e) { return e.is_none(); });
+    }
+
+    auto** children = static_cast<void**>(d);
+    auto& child = children[G::index(va, i)];
+    if ((child != nullptr) && erase(child, i + 1, va)) {
+      release(child, i + 1);
+      child = nullptr;
+    }
+    return std::all_of(children, children + G::fanout(i), [](auto c) { return c == nullptr; });
+  }
+
+  /// Implements `for_each` for `d`, which is a directory of the `i`-th level mapping addresses
+  /// with the prefix `base`.
+  template<typename F>
+  void for_each(void* d, std::size_t i, Address base, F& action) {
+    for (std::size_t j = 0; j < G::fanout(i); ++j) {
+      auto const a = static_cast<Address>(base | (static_cast<Address>(j) << G::shift(i)));
+      if (i + 1 == G::level_count) {
+        auto& e = static_cast<Entry*>(d)[j];
+        if (!e.is_none()) { action(a, e); }
+      } else if (auto* child = static_cast<void**>(d)[j]) {
+        for_each(child, i + 1, a, action);
+      }
+    }
+  }
+
+};
+
+/// A virtual machine whose address space is described by `G`, equipped with `frame_count` frames
+/// of main memory and unbounded secondary memory.
+///
+/// This type generalizes `Machine` to large, sparse address spaces. It shares the representation
+/// of page entries (see `BasicPageEntry`), the TLB (see `BasicTLB`) and lookup errors with
+/// `Machine`, but not its code: the table walk and the fault handler, which is called when the
+/// translation table has no entry for a page, are separate implementations, since `Machine`
+/// encodes its tables in its own main memory. The translation table itself is an instance of
+/// `Table<G>`; it is a radix tree by default (see `RadixPageTable`) and can be replaced by a
+/// hashed inverted table (see `HashedPageTable`). A table is created with the number of frames in
+/// main memory and must provide:
+///
+/// - `find(va)`, which returns a pointer to the entry of the page containing `va` or `nullptr`;
+/// - `assign(va, e)`, which maps the page containing `va` to `e`;
+/// - `erase(va)`, which removes the mapping of the page containing `va`;
+/// - `for_each(action)`, which calls `action(page, e)` for each mapped page; and
+/// - `footprint()`, which returns the number of bytes occupied by the table.
+///
+/// The TLB is an instance of `TLB<Address, std::uint64_t, tlb_size>`. It is a `BasicTLB` by
+/// default and can be replaced by an `AssociativeTLB`, whose lookups remain cheap for larger
+/// sizes:
+///
+///     WideMachine<Geometry48, RadixPageTable, 16, 64, AssociativeTLB> m;
+///
+/// Unlike `Machine`, mappings are created lazily: `mmap` records a region of the address space
+/// and pages are allocated upon their first access, which makes it possible to reserve large
+/// regions (e.g., a stack at the top of the address space and a heap at the bottom).
+///
+/// The first page of the address space is never mapped so that the null address has no
+/// translation.
+template<
+  typename G,
+  template<typename> typename Table = RadixPageTable,
+  std::size_t frame_count = 16,
+  std::size_t tlb_size = 4,
+  template<typename, typename, std::size_t> typename TLB = BasicTLB
+>
+struct WideMachine {
+
+  /// The type of an address.
+  using Address = typename G::address_type;
+
+  /// The type of a page entry.
+  using Entry = BasicPageEntry<std::uint64_t>;
+
+  /// The type of a physical address.
+  using PhysicalAddress = std::uint64_t;
+
+  /// The type of the errors thrown when translation fails.
+  using LookupError = BasicPageLookupError<Address>;
+
+  /// A contiguous region of mapped addresses.
+  struct Region {
+
+    /// The address immediately after the end of the region.
+    std::uint64_t end;
+
+    /// The protection of the pages in the region.
+    PageEntry::Protection protection;
+
+  };
+
+  /// The page translation table.
+  Table<G> table;
+
+  /// The translation lookaside buffer of the machine.
+  TLB<Address, std::uint64_t, tlb_size> tlb;
+
+  /// The main memory of the machine.
+  std::vector<std::byte> main_memory;
+
+  /// The secondary memory of the machine, divided in slots of one page.
+  ///
+  /// The first slot is reserved so that a slot index is never zero.
+  std::vector<std::byte> secondary_memory;
+
+  /// The slots of secondary memory that can be reused.
+  std::vector<std::uint64_t> free_slots;
+
+  /// The address of the page stored in each frame.
+  ///
+  /// The state of the frames is stored as a structure of arrays, so that free frames and victims
+  /// are found by scanning `used_frames` and `referenced_frames` a word at a time.
+  std::array<Address, frame_count> frame_pages = {};
+
+  /// The frames storing a page.
+  FrameBitset<frame_count> used_frames;
+
+  /// The frames that have been referenced since the last stealing pass.
+  FrameBitset<frame_count> referenced_frames;
+
+  /// The position of the clock hand used to select victims.
+  std::size_t hand = 0;
+
+  /// The mapped regions, ordered by their start address.
+  std::map<std::uint64_t, Region> regions;
+
+  /// Creates an instance with an empty address space.
+  WideMachine()
+    : table(frame_count),
+      main_memory(frame_count * G::page_size),
+      secondary_memory(G::page_size)
+  {}
+
+  /// Reads a byte from physical address `pa`.
+  inline std::byte read_byte(PhysicalAddress pa) const {
+    return main_memory[pa];
+  }
+
+  /// Stores `b` at physical address `pa`.
+  inline void store_byte(std::byte b, PhysicalAddress pa) {
+    main_memory[pa] = b;
+  }
+
+  /// Returns the physical address corresponding to `va` accessed with `permissions`, knowing that
+  /// `va` resides in the page described by `pte`.
+  PhysicalAddress translate_with_entry(
+    Address va, PageEntry::Protection permissions, Entry pte, bool update_tlb
+  ) {
+    // Does the page have the right protection?
+    if ((pte.protection() & permissions) != permissions) {
+      throw LookupError{va, PermissionFault};
+    }
+
+    // Otherwise, the frame number contains the location where the page has been swapped out.
+    if (!pte.is_present()) { pte = swap_in(G::page(va), pte.frame()); }
+    if (update_tlb) { tlb.insert(G::page(va), pte.raw); }
+
+    referenced_frames.set(pte.frame());
+    return (pte.frame() << G::page_shift) | G::offset(va);
+  }
+
+  /// Returns the physical address corresponding to `va` accessed with `permissions`, handling
+  /// missing translations with `handle_segfault`.
+  ///
+  /// The translation first checks whether the page containing `va` is in the TLB. Otherwise, it
+  /// looks up the translation table. If the page has no entry, the method calls
+  /// `handle_segfault(this, va, permissions)`, which is expected to either map the page or throw.
+  template<typename F>
+  PhysicalAddress translate(Address va, PageEntry::Protection permissions, F&& handle_segfault) {
+    // The first page has no translation.
+    if (G::page(va) == 0) { throw LookupError(va, SegmentationFault); }
+
+    // Check the TLB.
+    auto const cached = Entry::from_raw(tlb.lookup(G::page(va)));
+    if (!cached.is_none()) {
+      assert(cached.is_present());
+      return translate_with_entry(va, permissions, cached, false);
+    }
+
+    // Look up the translation table.
+    auto* pte = table.find(va);
+    if (pte == nullptr) {
+      handle_segfault(this, va, permissions);
+      pte = table.find(va);
+      assert(pte != nullptr);
+    }
+    return translate_with_entry(va, permissions, *pte, true);
+  }
+
+  /// Returns the physical address corresponding to `va` accessed with `permissions`, allocating
+  /// the page containing `va` if it belongs to a mapped region.
+  PhysicalAddress translate(Address va, PageEntry::Protection permissions) {
+    return translate(va, permissions, &WideMachine::allocate_in_region);
+  }
+
+  /// Maps the page containing `va` with the given protection and returns the physical address
+  /// corresponding to `va`, or throws if that page is already part of a region.
+  PhysicalAddress allocate_page(Address va, PageEntry::Protection ps) {
+    std::uint64_t const page = G::page(va);
+    if ((page == 0) || (overlapping(page, page + G::page_size) != regions.end())) {
+      throw std::invalid_argument("page already mapped");
+    }
+    regions[page] = {page + G::page_size, ps};
+    return translate(va, ps);
+  }
+
+  /// Reserves a region in the virtual address space with the specified `length` and `protection`
+  /// and returns its address.
+  ///
+  /// If `hint` is null, the region is placed at the lowest available address above the first 16
+  /// pages. Otherwise, the kernel picks the first available address from the page containing
+  /// `hint`, wrapping around once. Pages are allocated upon their first access.
+  Address mmap(Address hint, std::uint64_t length, PageEntry::Protection protection) {
+    if (length == 0) { throw std::invalid_argument("empty mapping"); }
+    auto const extent = (length + G::page_size - 1) & ~std::uint64_t{G::page_size - 1};
+    if (extent >= G::size) { throw std::bad_alloc(); }
+
+    std::uint64_t const lowest = G::page_size;
+    std::uint64_t start = (hint == 0) ? 16 * std::uint64_t{G::page_size} : G::page(hint);
+    if (start + extent > G::size) { start = lowest; }
+
+    auto a = start;
+    bool wrapped = false;
+    while (true) {
+      // Does the candidate overlap a region? If so, try again after that region.
+      auto const next = overlapping(a, a + extent);
+      if (next == regions.end()) { break; }
+      a = next->second.end;
+
+      if (a + extent > G::size) {
+        if (wrapped) { throw std::bad_alloc(); }
+        a = lowest;
+        wrapped = true;
+      }
+      if (wrapped && (a >= start)) { throw std::bad_alloc(); }
+    }
+
+    regions[a] = {a + extent, protection};
+    return static_cast<Address>(a);
+  }
+
+  /// Removes the mappings of the pages containing the addresses in the range from `va` to
+  /// `va + length`, which may intersect several regions.
+  void munmap(Address va, std::uint64_t length) {
+    if ((length == 0) || (G::page(va) != va) || (va + length > G::size)) {
+      throw std::invalid_argument("invalid mapping");
+    }
+    std::uint64_t const start = va;
+    auto const end = (start + length + G::page_size - 1) & ~std::uint64_t{G::page_size - 1};
+
+    // Trim the regions.
+    for (auto r = overlapping(start, end); r != regions.end(); r = overlapping(start, end)) {
+      auto const [s, region] = *r;
+      regions.erase(r);
+      if (s < start) { regions[s] = {start, region.protection}; }
+      if (region.end > end) { regions[end] = {region.end, region.protection}; }
+    }
+
+    // Release the pages.
+    std::vector<std::pair<Address, Entry>> pages;
+    table.for_each([&](Address page, Entry e) {
+      if ((page >= start) && (page < end)) { pages.emplace_back(page, e); }
+    });
+    for (auto const& [page, e] : pages) {
+      if (e.is_present()) {
+        tlb.invalidate(e.raw);
+        release_frame(e.frame());
+      } else {
+        free_slots.push_back(e.frame());
+      }
+      table.erase(page);
+    }
+  }
+
+  /// A fault handler that simply throws.
+  static void rethrow(WideMachine*, Address va, PageEntry::Protection) {
+    throw LookupError(va, SegmentationFault);
+  }
+
+  /// A fault handler that allocates a frame for `va` if it belongs to a mapped region, using the
+  /// protection of that region, or throws otherwise.
+  static void allocate_in_region(WideMachine* self, Address va, PageEntry::Protection) {
+    auto const r = self->overlapping(va, std::uint64_t{va} + 1);
+    if (r == self->regions.end()) { throw LookupError(va, SegmentationFault); }
+    allocate_on_segfault(self, va, r->second.protection);
+  }
+
+  /// A fault handler that allocates a zero-initialized frame for `va`.
+  static void allocate_on_segfault(WideMachine* self, Address va, PageEntry::Protection ps) {
+    auto const f = self->allocate_frame(G::page(va));
+    std::fill_n(self->main_memory.begin() + (f << G::page_shift), G::page_size, std::byte{0});
+
+    Entry pte{};
+    pte.set_present(true);
+    pte.set_protection(ps);
+    pte.set_frame(f);
+    self->table.assign(va, pte);
+  }
+
+  /// Returns the region overlapping the range from `start` to `end`, if any.
+  typename std::map<std::uint64_t, Region>::iterator overlapping(
+    std::uint64_t start, std::uint64_t end
+  ) {
+    auto r = regions.lower_bound(end);
+    if (r == regions.begin()) { return regions.end(); }
+    --r;
+    return (r->second.end > start) ? r : regions.end();
+  }
+
+  /// Returns the index of a frame to store the page at `page`, evicting another page if needed.
+  std::uint64_t allocate_frame(Address page) {
+    auto i = used_frames.find_next_clear(0);
+    if (i == frame_count) { i = evict(); }
+    frame_pages[i] = page;
+    used_frames.set(i);
+    referenced_frames.set(i);
+    return i;
+  }
+
+  /// Marks the frame at index `f` as free.
+  void release_frame(std::uint64_t f) {
+    frame_pages[f] = 0;
+    used_frames.set(f, false);
+    referenced_frames.set(f, false);
+  }
+
+  /// Selects a page to evict with the clock algorithm, swaps its contents to secondary memory,
+  /// and returns the index of the freed frame.
+  std::uint64_t evict() {
+    // Advance the hand to the first frame that was not referenced, clearing the referenced bits
+    // of the frames it passes a word at a time. All frames are used when a victim is needed.
+    auto victim = referenced_frames.find_next_clear(hand);
+    if (victim != frame_count) {
+      referenced_frames.clear_range(hand, victim);
+    } else {
+      referenced_frames.clear_range(hand, frame_count);
+      victim = referenced_frames.find_next_clear(0);
+      referenced_frames.clear_range(0, std::min(victim, hand));
+      if (victim >= hand) { victim = hand; }
+    }
+    hand = (victim + 1) % frame_count;
+
+    // Swap the contents of the victim out.
+    auto const slot = acquire_slot();
+    std::copy_n(
+      main_memory.begin() + (victim << G::page_shift), G::page_size,
+      secondary_memory.begin() + (slot << G::page_shift));
+
+    // Update the translation table.
+    auto const page = frame_pages[victim];
+    auto pte = *table.find(page);
+    tlb.invalidate(pte.raw);
+    pte.set_frame(slot);
+    pte.set_present(false);
+    table.assign(page, pte);
+
+    release_frame(victim);
+    return victim;
+  }
+
+  /// Moves the page at `page`, whose contents is stored at `slot`, into main memory and returns
+  /// its updated entry.
+  Entry swap_in(Address page, std::uint64_t slot) {
+    auto pte = *table.find(page);
+    auto const f = allocate_frame(page);
+    std::copy_n(
+      secondary_memory.begin() + (slot << G::page_shift), G::page_size,
+      main_memory.begin() + (f << G::page_shift));
+    free_slots.push_back(slot);
+
+    pte.set_frame(f);
+    pte.set_present(true);
+    table.assign(page, pte);
+    return pte;
+  }
+
+  /// Returns the index of a free slot in secondary memory.
+  std::uint64_t acquire_slot() {
+    if (!free_slots.empty()) {
+      auto const s = free_slots.back();
+      free_slots.pop_back();
+      return s;
+    }
+    auto const s = secondary_memory.size() >> G::page_shift;
+    secondary_memory.resize(secondary_memory.size() + G::page_size);
+    return s;
+  }
+
+};
+
+} // namespace mmu
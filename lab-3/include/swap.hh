@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+namespace mmu {
+
+/// A device of secondary memory, holding a contiguous range of swap slots.
+///
+/// The cost of transferring a page to or from the device is its access latency plus the time
+/// needed to transfer 256 bytes at its bandwidth. Released slots are allocated again first; other
+/// slots are allocated in order, from `first`.
+struct SwapDevice {
+
+  /// Statistics about a device.
+  struct Statistics {
+
+    /// The number of pages read from the device.
+    std::size_t reads = 0;
+
+    /// The number of pages written to the device.
+    std::size_t writes = 0;
+
+    /// The total cost of the transfers, in cycles.
+    std::uint64_t cycles = 0;
+
+  };
+
+  /// The priority of the device; devices with a higher priority are filled first.
+  int priority;
+
+  /// The first slot of the device.
+  std::uint16_t first;
+
+  /// The number of slots of the device.
+  std::uint16_t count;
+
+  /// The access latency of the device, in cycles.
+  std::uint64_t latency;
+
+  /// The bandwidth of the device, in bytes per cycle.
+  double bandwidth;
+
+  /// The number of slots allocated so far, including the ones released since.
+  std::uint16_t used = 0;
+
+  /// The slots that have been released, which are allocated again before the others.
+  std::vector<std::uint16_t> free_slots;
+
+  /// Statistics about the device.
+  Statistics statistics;
+
+  /// Returns the cost of transferring a page to or from the device, in cycles.
+  inline std::uint64_t cost() const {
+    return latency + static_cast<std::uint64_t>(std::ceil(256 / bandwidth));
+  }
+
+  /// Returns `true` iff `slot` belongs to this device.
+  inline bool contains(std::uint16_t slot) const {
+    return (slot >= first) && (slot - first < count);
+  }
+
+  /// Returns `true` iff the device has a slot to allocate.
+  inline bool has_free_slot() const {
+    return !free_slots.empty() || (used < count);
+  }
+
+  /// Returns the number of slots of the device that are allocated.
+  inline std::size_t allocated_count() const {
+    return used - free_slots.size();
+  }
+
+  /// Returns `true` iff `slot` belongs to this device and is allocated.
+  inline bool is_allocated(std::uint16_t slot) const {
+    return (slot >= first) && (slot - first < used)
+      && (std::find(free_slots.begin(), free_slots.end(), slot) == free_slots.end());
+  }
+
+};
+
+/// The swap devices sharing the slots of secondary memory.
+///
+/// Slots are allocated on the devices of highest priority that have free slots, as with Linux's
+/// `swapon -p`. Devices of equal priority are used in turn, so that consecutive evictions are
+/// striped across them. Hence, a fast device can absorb the swap traffic and a slow one only
+/// receive pages once the fast one is full. Slots are released when their pages are swapped in or
+/// unmapped, so that a device is full only while it stores as many pages as it has slots.
+///
+/// Secondary memory has a single device covering all slots unless devices are added, in which
+/// case each device owns the next range of slots after the previous ones, from slot 1.
+struct SwapDevices {
+
+  /// The number of slots of secondary memory, including the reserved slot 0.
+  static constexpr std::size_t slot_count = 1024;
+
+  /// The devices, in the order in which they have been added.
+  std::vector<SwapDevice> devices;
+
+  /// The index of the device at which the search for the next slot to allocate starts.
+  std::size_t cursor = 0;
+
+  /// Returns `true` iff devices have been added.
+  inline bool is_enabled() const {
+    return !devices.empty();
+  }
+
+  /// Adds a device of `count` slots with the given `priority`, `latency` in cycles, and
+  /// `bandwidth` in bytes per cycle, and returns its index in `devices`.
+  ///
+  /// The method throws `std::invalid_argument` if there are not enough slots left.
+  std::size_t add(int priority, std::uint16_t count, std::uint64_t latency, double bandwidth) {
+    std::size_t const first = devices.empty() ? 1 : devices.back().first + devices.back().count;
+    if ((count == 0) || (first + count > slot_count) || !(bandwidth > 0)) {
+      throw std::invalid_argument("invalid swap device");
+    }
+    devices.emplace_back(priority, static_cast<std::uint16_t>(first), count, latency, bandwidth);
+    return devices.size() - 1;
+  }
+
+  /// Allocates a slot and returns it, or returns `std::nullopt` if all devices are full.
+  std::optional<std::uint16_t> allocate() {
+    // Find the highest priority among the devices that have free slots.
+    std::optional<int> priority;
+    for (auto const& d : devices) {
+      if (d.has_free_slot() && (!priority || (d.priority > *priority))) { priority = d.priority; }
+    }
+    if (!priority) { return std::nullopt; }
+
+    // Use the next device of that priority after the last one used.
+    for (std::size_t i = 0; i < devices.size(); ++i) {
+      auto const k = (cursor + i) % devices.size();
+      auto& d = devices[k];
+      if ((d.priority == *priority) && d.has_free_slot()) {
+        cursor = k + 1;
+        if (d.free_slots.empty()) { return static_cast<std::uint16_t>(d.first + d.used++); }
+        auto const slot = d.free_slots.back();
+        d.free_slots.pop_back();
+        return slot;
+      }
+    }
+    return std::nullopt;
+  }
+
+  /// Releases `slot`, which is allocated, so that it can be allocated again.
+  void release(std::uint16_t slot) {
+    auto* d = device_of(slot);
+    assert((d != nullptr) && d->is_allocated(slot));
+    d->free_slots.push_back(slot);
+  }
+
+  /// Returns the device holding `slot`, or `nullptr` if there is none.
+  SwapDevice* device_of(std::uint16_t slot) {
+    for (auto& d : devices) {
+      if (d.contains(slot)) { return &d; }
+    }
+    return nullptr;
+  }
+
+};
+
+} // namespace mmu
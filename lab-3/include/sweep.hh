@@ -0,0 +1,167 @@
+#pragma once
+
+#include "trace.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mmu {
+
+/// Writes `trace` to the file at `path`, in the format read by `MappedTrace`.
+///
+/// The file is the array of accesses in the representation of the host, so it is meant to be
+/// read back on the same host.
+inline void save_trace(std::string const& path, std::span<Access const> trace) {
+  std::ofstream stream(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!stream) { throw std::invalid_argument("cannot open " + path); }
+  stream.write(reinterpret_cast<char const*>(trace.data()), std::streamsize(trace.size_bytes()));
+}
+
+/// A trace saved with `save_trace`, mapped read-only in the address space of the host.
+///
+/// The pages of the file are shared by all the threads reading the trace, and loaded on demand by
+/// the host, so that a long trace can be replayed by many machines without being copied.
+struct MappedTrace {
+
+  /// The address at which the file is mapped, or `nullptr` if the file is empty.
+  void* base = nullptr;
+
+  /// The size of the file, in bytes.
+  std::size_t size = 0;
+
+  /// Maps the file at `path`.
+  explicit MappedTrace(std::string const& path) {
+    auto const fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { throw std::invalid_argument("cannot open " + path); }
+
+    struct stat s;
+    if ((::fstat(fd, &s) != 0) || (s.st_size % sizeof(Access) != 0)) {
+      ::close(fd);
+      throw std::invalid_argument("not a trace: " + path);
+    }
+
+    size = static_cast<std::size_t>(s.st_size);
+    if (size != 0) {
+      base = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (base == MAP_FAILED) { throw std::invalid_argument("cannot map " + path); }
+  }
+
+  MappedTrace(MappedTrace const&) = delete;
+  MappedTrace& operator=(MappedTrace const&) = delete;
+
+  /// Unmaps the file.
+  ~MappedTrace() {
+    if (base != nullptr) { ::munmap(base, size); }
+  }
+
+  /// Returns the accesses of the trace.
+  inline std::span<Access const> accesses() const {
+    return {static_cast<Access const*>(base), size / sizeof(Access)};
+  }
+
+};
+
+/// A configuration of a machine in a parameter sweep.
+///
+/// A configuration can only set the parameters of a `Machine` that are data members, such as the
+/// TLB prefetcher, the watermarks, the cost model, the caches or the swap devices. The size of the
+/// TLB and the number of frames are compile-time constants of `Machine`, so they cannot be swept.
+/// `WideMachine` takes both as template parameters, but it has no latency model and no reclaim
+/// statistics to report, and traces hold the 16-bit addresses of `Machine`.
+struct SweepConfiguration {
+
+  /// The name of the configuration, used to label its results.
+  std::string name;
+
+  /// A function configuring a fresh machine before the trace is replayed.
+  std::function<void(Machine&)> configure;
+
+};
+
+/// The statistics of a machine after the replay of a trace in a parameter sweep.
+struct SweepResult {
+
+  /// The name of the configuration.
+  std::string name;
+
+  /// The latency of the accesses, for all cores combined.
+  LatencyStatistics::Core latency;
+
+  /// Statistics about page reclaim.
+  Machine::ReclaimStatistics reclaim;
+
+};
+
+/// Replays `trace` on a fresh machine for each of the `configurations`, using up to `thread_count`
+/// threads, and returns the results in the order of the configurations.
+///
+/// Machines share no state, so each configuration is replayed independently by the first idle
+/// thread and the sweep scales with the number of cores. The trace is only read. If the replay of
+/// some configuration throws, the sweep completes and the first exception, in the order of the
+/// configurations, is rethrown.
+inline std::vector<SweepResult> sweep(
+  std::span<Access const> trace, std::span<SweepConfiguration const> configurations,
+  std::size_t thread_count = std::thread::hardware_concurrency()
+) {
+  std::vector<SweepResult> results(configurations.size());
+  std::vector<std::exception_ptr> errors(configurations.size());
+  std::atomic<std::size_t> next = 0;
+
+  auto const work = [&] {
+    for (auto i = next++; i < configurations.size(); i = next++) {
+      try {
+        auto m = std::make_unique<Machine>();
+        if (configurations[i].configure) { configurations[i].configure(*m); }
+        replay(*m, trace);
+        results[i] = {configurations[i].name, m->latency.total(), m->reclaim_statistics};
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }
+  };
+
+  {
+    std::vector<std::jthread> threads;
+    auto const n = std::min(std::max<std::size_t>(thread_count, 1), configurations.size());
+    for (std::size_t t = 1; t < n; ++t) { threads.emplace_back(work); }
+    work();
+  }
+
+  for (auto const& e : errors) {
+    if (e) { std::rethrow_exception(e); }
+  }
+  return results;
+}
+
+/// Writes `results` to `o` as a table in CSV format, with one row per configuration.
+inline void write_sweep_table(std::ostream& o, std::span<SweepResult const> results) {
+  o << "configuration,accesses,cycles,amat";
+  for (auto const name : event_names) { o << ',' << name; }
+  o << ",direct_reclaim,background_reclaim\n";
+
+  for (auto const& r : results) {
+    o << r.name << ',' << r.latency.accesses << ',' << r.latency.cycles << ',' << r.latency.amat();
+    for (auto const n : r.latency.events) { o << ',' << n; }
+    o << ',' << r.reclaim.direct << ',' << r.reclaim.background << '\n';
+  }
+}
+
+} // namespace mmu
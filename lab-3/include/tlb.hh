@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// Define `MMU_SCALAR_TLB` to compile the portable code path on any target, e.g., to test it.
+#if !defined(MMU_SCALAR_TLB) && defined(__AVX2__)
+#define MMU_TLB_AVX2
+#elif !defined(MMU_SCALAR_TLB) && defined(__SSE2__)
+#define MMU_TLB_SSE2
+#endif
+
+#if defined(MMU_TLB_AVX2) || defined(MMU_TLB_SSE2)
+#include <immintrin.h>
+#endif
+
+namespace mmu {
+
+/// A fully associative translation lookaside buffer whose tags are compared in parallel.
+///
+/// Unlike `BasicTLB`, which scans a ring buffer in most-recently-used order, this TLB stores its
+/// keys in a contiguous aligned array, separately from the page entries they map. A lookup
+/// compares 32 bytes of keys per instruction with AVX2, or 16 bytes with SSE2, and derives the
+/// index of the hit from the resulting mask. A scalar loop is used on other targets, or if
+/// `MMU_SCALAR_TLB` is defined (see the `test-scalar` and `test-avx2` targets of the Makefile).
+/// Hence, a lookup in a TLB of 64 entries of 16 bits takes only 4 comparisons with AVX2, which
+/// makes large TLBs about as cheap to probe as a small one.
+///
+/// The entries are replaced in LRU order. As with `BasicTLB`, an empty entry is represented by a
+/// pair of zeros, and the type is a drop-in replacement for it (see `WideMachine`).
+template<typename Key, typename Value, std::size_t size>
+struct AssociativeTLB {
+
+  static_assert(std::has_single_bit(sizeof(Key)) && (sizeof(Key) <= 8), "unsupported key type");
+
+  /// The number of bytes compared per instruction.
+  static constexpr std::size_t vector_size = 32;
+
+  /// The number of keys in the key array, padded with empty keys to a multiple of `vector_size`
+  /// bytes.
+  static constexpr std::size_t capacity =
+    (size * sizeof(Key) + vector_size - 1) / vector_size * vector_size / sizeof(Key);
+
+  /// An entry in a TLB.
+  struct Element {
+
+    /// The page-aligned address of the entry.
+    Key key;
+
+    /// The page table entry to which `key` is mapped.
+    Value value;
+
+  };
+
+  /// The keys of the entries, followed by empty keys.
+  alignas(vector_size) Key keys[capacity] = {};
+
+  /// The page entries to which the keys are mapped.
+  Value values[size] = {};
+
+  /// The time of the last use of each entry.
+  std::uint64_t last_use[size] = {};
+
+  /// The number of insertions and hits so far, used as a clock for LRU replacement.
+  std::uint64_t clock = 0;
+
+  /// Returns the `i`-th entry of this TLB, in no particular order.
+  inline constexpr Element operator[](std::size_t i) const {
+    return {keys[i], values[i]};
+  }
+
+  /// Returns the index of the entry whose key is `va`, or `size` if there is none.
+  std::size_t find(Key va) const {
+#if defined(MMU_TLB_AVX2)
+    auto const needle = broadcast256(va);
+    for (std::size_t i = 0; i < capacity; i += 32 / sizeof(Key)) {
+      auto const block = _mm256_load_si256(reinterpret_cast<__m256i const*>(keys + i));
+      auto const equal = _mm256_cmpeq_epi8(block, needle);
+      auto const m = static_cast<std::uint32_t>(_mm256_movemask_epi8(equal));
+      if (auto const lanes = whole_lanes(m); lanes != 0) {
+        return std::min(i + std::countr_zero(lanes) / sizeof(Key), size);
+      }
+    }
+    return size;
+#elif defined(MMU_TLB_SSE2)
+    auto const needle = broadcast128(va);
+    for (std::size_t i = 0; i < capacity; i += 16 / sizeof(Key)) {
+      auto const block = _mm_load_si128(reinterpret_cast<__m128i const*>(keys + i));
+      auto const equal = _mm_cmpeq_epi8(block, needle);
+      auto const m = static_cast<std::uint32_t>(_mm_movemask_epi8(equal));
+      if (auto const lanes = whole_lanes(m); lanes != 0) {
+        return std::min(i + std::countr_zero(lanes) / sizeof(Key), size);
+      }
+    }
+    return size;
+#else
+    return static_cast<std::size_t>(std::find(keys, keys + size, va) - keys);
+#endif
+  }
+
+  /// Returns `true` iff this TLB contains a record for the page-aligned address `va`.
+  inline bool contains(Key va) const {
+    return find(va) != size;
+  }
+
+  /// Inserts a record in this TLB, mapping the page-aligned address `va` to the page entry `pte`,
+  /// replacing an empty entry or the least recently used one.
+  ///
+  /// - Requires: there is no record mapping `va` to a page entry before the method is called.
+  void insert(Key va, Value pte) {
+    auto i = find(Key{0});
+    if (i == size) {
+      i = static_cast<std::size_t>(std::min_element(last_use, last_use + size) - last_use);
+    }
+    keys[i] = va;
+    values[i] = pte;
+    last_use[i] = ++clock;
+  }
+
+  /// Returns the cached page table entry corresponding to the given page-aligned address, if any.
+  ///
+  /// The method returns an empty PTE (i.e., a PTE whose raw value is zero) iff the cache contains
+  /// no entry mapping `va`.
+  Value lookup(Key va) {
+    auto const i = find(va);
+    if (i == size) { return Value{0}; }
+    last_use[i] = ++clock;
+    return values[i];
+  }
+
+  /// Invalidates all entries referring to `pte`.
+  void invalidate(Value pte) {
+    for (std::size_t i = 0; i < size; ++i) {
+      if (values[i] == pte) {
+        keys[i] = 0;
+        values[i] = 0;
+        last_use[i] = 0;
+      }
+    }
+  }
+
+private:
+
+  /// Returns the mask of the lanes of `Key` whose bytes are all set in `m`, which is the result of
+  /// a byte-wise comparison, with one bit at the first byte of each such lane.
+  static constexpr std::uint32_t whole_lanes(std::uint32_t m) {
+    for (std::size_t s = 1; s < sizeof(Key); s <<= 1) { m &= m >> s; }
+    constexpr std::uint32_t starts[] = {
+      0xffffffff, 0x55555555, 0, 0x11111111, 0, 0, 0, 0x01010101
+    };
+    return m & starts[sizeof(Key) - 1];
+  }
+
+#if defined(MMU_TLB_AVX2)
+  /// Returns a vector whose lanes are all equal to `va`.
+  static __m256i broadcast256(Key va) {
+    if constexpr (sizeof(Key) == 1) { return _mm256_set1_epi8(static_cast<char>(va)); }
+    if constexpr (sizeof(Key) == 2) { return _mm256_set1_epi16(static_cast<short>(va)); }
+    if constexpr (sizeof(Key) == 4) { return _mm256_set1_epi32(static_cast<int>(va)); }
+    if constexpr (sizeof(Key) == 8) { return _mm256_set1_epi64x(static_cast<long long>(va)); }
+  }
+#elif defined(MMU_TLB_SSE2)
+  /// Returns a vector whose lanes are all equal to `va`.
+  static __m128i broadcast128(Key va) {
+    if constexpr (sizeof(Key) == 1) { return _mm_set1_epi8(static_cast<char>(va)); }
+    if constexpr (sizeof(Key) == 2) { return _mm_set1_epi16(static_cast<short>(va)); }
+    if constexpr (sizeof(Key) == 4) { return _mm_set1_epi32(static_cast<int>(va)); }
+    if constexpr (sizeof(Key) == 8) { return _mm_set1_epi64x(static_cast<long long>(va)); }
+  }
+#endif
+
+};
+
+} // namespace mmu
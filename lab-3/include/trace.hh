@@ -0,0 +1,52 @@
+#pragma once
+
+#include "mmu.hh"
+
+#include <span>
+#include <vector>
+
+namespace mmu {
+
+/// A memory access recorded in a trace.
+struct Access {
+
+  /// The virtual address being accessed.
+  VirtualAddress va;
+
+  /// The permissions required by the access.
+  PageEntry::Protection permissions;
+
+};
+
+/// A sequence of memory accesses.
+using Trace = std::vector<Access>;
+
+/// Replays `trace` on `m`, calling `observe(a, pa)` after each access `a` has been translated to
+/// the physical address `pa`.
+///
+/// Pages are mapped on first touch with read and write permissions, so that a trace can be
+/// replayed on a fresh machine. Accesses requiring execution rights on such pages therefore raise
+/// a permission fault.
+///
+/// The latency of the accesses is accumulated in `m.latency`, on behalf of `m.core`, so that the
+/// average memory access time of the trace can be read after the replay.
+template<typename F>
+void replay(Machine& m, std::span<Access const> trace, F&& observe) {
+  auto const map_on_touch = [](
+    Machine* self, VirtualAddress va, PageEntry::Protection, std::uint16_t* pda, std::size_t i
+  ) {
+    Machine::allocate_on_segfault(self, va, PageEntry::read | PageEntry::write, pda, i);
+  };
+
+  for (auto const& a : trace) {
+    auto const pa = m.translate(a.va, a.permissions, map_on_touch);
+    observe(a, pa);
+  }
+}
+
+/// Replays `trace` on `m`.
+inline void replay(Machine& m, std::span<Access const> trace) {
+  replay(m, trace, [](Access const&, PhysicalAddress) {});
+}
+
+} // namespace mmu
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <span>
+#include <vector>
+
+namespace mmu {
+
+/// Compresses `input` into `output`, replacing its contents, and returns the compressed size.
+///
+/// The compressed representation is a sequence of tokens in the style of LZ4, simplified for
+/// inputs of at most a few pages:
+///
+/// - a byte `t` less than `0x80` is followed by a run of `t + 1` literal bytes;
+/// - a byte `t` greater than or equal to `0x80` is followed by a byte `d` and denotes a copy of
+///   `(t & 0x7f) + 3` bytes from `d` bytes before the current position, which may overlap the
+///   bytes being copied (e.g., a run of zeros is encoded as one literal and one copy).
+///
+/// Matches are found greedily with a hash table of the last position of each 3-byte prefix.
+inline std::size_t lz_compress(
+  std::span<std::byte const> input, std::vector<std::uint8_t>& output
+) {
+  output.clear();
+  auto const n = input.size();
+  auto const at = [&](std::size_t i) { return static_cast<std::uint8_t>(input[i]); };
+
+  // Emits the literals from `start` to `end`.
+  std::size_t start = 0;
+  auto const flush = [&](std::size_t end) {
+    while (start < end) {
+      auto const k = std::min<std::size_t>(128, end - start);
+      output.push_back(static_cast<std::uint8_t>(k - 1));
+      for (std::size_t j = 0; j < k; ++j) { output.push_back(at(start + j)); }
+      start += k;
+    }
+  };
+
+  std::array<std::size_t, 256> last = {};
+  last.fill(n);
+
+  std::size_t i = 0;
+  while (i + 3 <= n) {
+    auto const key = std::uint32_t{at(i)} | (std::uint32_t{at(i + 1)} << 8)
+      | (std::uint32_t{at(i + 2)} << 16);
+    auto const h = (key * 2654435761u) >> 24;
+    auto const candidate = last[h];
+    last[h] = i;
+
+    if ((candidate < i) && (i - candidate <= 0xff)
+      && (at(candidate) == at(i)) && (at(candidate + 1) == at(i + 1))
+      && (at(candidate + 2) == at(i + 2)))
+    {
+      std::size_t length = 3;
+      while ((i + length < n) && (length < 0x82) && (at(candidate + length) == at(i + length))) {
+        ++length;
+      }
+      flush(i);
+      output.push_back(static_cast<std::uint8_t>(0x80 | (length - 3)));
+      output.push_back(static_cast<std::uint8_t>(i - candidate));
+      i += length;
+      start = i;
+    } else {
+      ++i;
+    }
+  }
+
+  flush(n);
+  return output.size();
+}
+
+/// Decompresses `input`, which has been produced by `lz_compress`, into `output`, whose size must
+/// be that of the original data.
+inline void lz_decompress(std::span<std::uint8_t const> input, std::span<std::byte> output) {
+  std::size_t o = 0;
+  for (std::size_t i = 0; i < input.size();) {
+    auto const t = input[i++];
+    if (t & 0x80) {
+      auto const length = std::size_t{t & 0x7fu} + 3;
+      auto const distance = std::size_t{input[i++]};
+      assert((distance > 0) && (distance <= o) && (o + length <= output.size()));
+      for (std::size_t j = 0; j < length; ++j, ++o) { output[o] = output[o - distance]; }
+    } else {
+      auto const length = std::size_t{t} + 1;
+      assert(o + length <= output.size());
+      for (std::size_t j = 0; j < length; ++j, ++o) { output[o] = std::byte{input[i++]}; }
+    }
+  }
+  assert(o == output.size());
+}
+
+/// A compressed tier of memory between main memory and secondary memory.
+///
+/// The pool stores evicted pages in compressed form, in host memory, keyed by the slot of
+/// secondary memory that they would otherwise occupy (as Linux's zswap does with swap offsets).
+/// Hence, the page entries of the machine are unaffected: a page that is not present refers to a
+/// slot, whose contents is looked up in the pool before secondary memory.
+///
+/// When a page does not fit in the pool, the oldest pages are decompressed and spilled to their
+/// slot in secondary memory. A page that does not compress below `threshold` bytes is rejected
+/// and written to secondary memory directly. The pool is disabled if its capacity is zero.
+struct CompressedPool {
+
+  /// The size of a page.
+  static constexpr std::size_t page_size = 256;
+
+  /// Statistics about the pool.
+  struct Statistics {
+
+    /// The number of pages stored in the pool.
+    std::size_t stores = 0;
+
+    /// The number of pages written to secondary memory because they did not compress well.
+    std::size_t rejects = 0;
+
+    /// The number of pages moved from the pool to secondary memory to make room for others.
+    std::size_t spills = 0;
+
+    /// The number of pages loaded from the pool.
+    std::size_t pool_hits = 0;
+
+    /// The number of pages loaded from secondary memory.
+    std::size_t secondary_hits = 0;
+
+    /// The total size of the pages stored in the pool, before compression.
+    std::size_t bytes_in = 0;
+
+    /// The total size of the pages stored in the pool, after compression.
+    std::size_t bytes_out = 0;
+
+    /// Returns the ratio between the size of the pages stored in the pool and their compressed
+    /// size, or 1 if no page has been stored.
+    inline double compression_ratio() const {
+      return (bytes_out == 0) ? 1.0 : static_cast<double>(bytes_in) / bytes_out;
+    }
+
+  };
+
+  /// A compressed page.
+  struct Entry {
+
+    /// The compressed contents of the page.
+    std::vector<std::uint8_t> data;
+
+    /// The time at which the page was stored, used to identify its position in `order`.
+    std::uint64_t time;
+
+  };
+
+  /// The maximum number of compressed bytes in the pool.
+  std::size_t capacity;
+
+  /// The maximum compressed size of a page that can be stored in the pool.
+  std::size_t threshold;
+
+  /// The number of compressed bytes in the pool.
+  std::size_t used = 0;
+
+  /// The pages in the pool, indexed by slot.
+  std::map<std::uint16_t, Entry> entries;
+
+  /// The slots in the pool with the times at which their pages were stored, oldest first.
+  ///
+  /// This queue may contain stale elements for pages that have been loaded since.
+  std::deque<std::pair<std::uint16_t, std::uint64_t>> order;
+
+  /// The number of pages stored so far, used as a clock.
+  std::uint64_t clock = 0;
+
+  /// Statistics about the pool.
+  Statistics statistics;
+
+  /// A buffer holding the result of the last compression.
+  std::vector<std::uint8_t> buffer;
+
+  /// The slots of the pages spilled to secondary memory by the last call to `store`.
+  std::vector<std::uint16_t> spilled_slots;
+
+  /// Creates a pool holding up to `capacity` compressed bytes and rejecting pages that do not
+  /// compress below `threshold` bytes.
+  CompressedPool(std::size_t capacity = 0, std::size_t threshold = page_size * 3 / 4)
+    : capacity(capacity), threshold(threshold)
+  {}
+
+  /// Stores `page` for `slot`, writing it to `secondary_memory` if it cannot be stored in the pool.
+  void store(std::uint16_t slot, std::byte const* page, std::byte* secondary_memory) {
+    assert(!entries.contains(slot));
+    spilled_slots.clear();
+    auto const size = (capacity == 0) ? 0 : lz_compress({page, page_size}, buffer);
+
+    // Is the page worth compressing?
+    if ((capacity == 0) || (size > threshold) || (size > capacity)) {
+      if (capacity != 0) { statistics.rejects++; }
+      std::copy_n(page, page_size, secondary_memory + slot * page_size);
+      return;
+    }
+
+    // Make room for the page.
+    while (used + size > capacity) { spill(secondary_memory); }
+
+    entries[slot] = {buffer, ++clock};
+    order.emplace_back(slot, clock);
+    used += size;
+    statistics.stores++;
+    statistics.bytes_in += page_size;
+    statistics.bytes_out += size;
+  }
+
+  /// Loads the page stored for `slot` into `page`, removing it from the pool if it was there.
+  void load(std::uint16_t slot, std::byte* page, std::byte const* secondary_memory) {
+    auto const e = entries.find(slot);
+    if (e == entries.end()) {
+      statistics.secondary_hits++;
+      std::copy_n(secondary_memory + slot * page_size, page_size, page);
+      return;
+    }
+
+    statistics.pool_hits++;
+    lz_decompress(e->second.data, {page, page_size});
+    used -= e->second.data.size();
+    entries.erase(e);
+  }
+
+  /// Removes the page stored for `slot` from the pool, if it is there, once it is no longer needed.
+  void discard(std::uint16_t slot) {
+    auto const e = entries.find(slot);
+    if (e == entries.end()) { return; }
+    used -= e->second.data.size();
+    entries.erase(e);
+  }
+
+  /// Moves the oldest page of the pool to secondary memory.
+  void spill(std::byte* secondary_memory) {
+    assert(!order.empty());
+    auto const [slot, time] = order.front();
+    order.pop_front();
+
+    auto const e = entries.find(slot);
+    if ((e == entries.end()) || (e->second.time != time)) { return; }
+    lz_decompress(e->second.data, {secondary_memory + slot * page_size, page_size});
+    used -= e->second.data.size();
+    entries.erase(e);
+    spilled_slots.push_back(slot);
+    statistics.spills++;
+  }
+
+};
+
+} // namespace mmu
@@ -0,0 +1,15 @@
+#include "invariants.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+/// The entry point of libFuzzer.
+///
+/// Each input is decoded as a sequence of operations applied to a fresh machine and to a reference
+/// model of its memory (see `mmu::DifferentialDriver`). Divergences and invariant violations are
+/// reported as uncaught exceptions.
+extern "C" int LLVMFuzzerTestOneInput(std::uint8_t const* data, std::size_t size) {
+  mmu::DifferentialDriver d;
+  d.run({data, size});
+  return 0;
+}
@@ -1,5 +1,14 @@
+#include "analysis.hh"
+#include "dump.hh"
+#include "hashed.hh"
+#include "invariants.hh"
 #include "mmu.hh"
+#include "radix.hh"
+#include "sweep.hh"
 #include <boost/ut.hpp>
+#include <filesystem>
+#include <fstream>
+#include <random>
 
 int main() {
   using namespace boost::ut;
@@ -53,5 +62,1060 @@ int main() {
     }
   };
 
+  "reuse_profile"_test = [] {
+    // Scan 4 pages cyclically: a LRU cache of 3 pages always misses whereas 4 pages suffice.
+    Trace trace;
+    for (auto i = 0; i < 64; ++i) {
+      trace.push_back({static_cast<std::uint16_t>(0x1000 + ((i % 4) << 8)), PageEntry::read});
+    }
+
+    Machine m;
+    auto const r = profile(m, trace);
+    expect(r.cold == 4);
+    expect(r.miss_ratio(3) == 1.0);
+    expect(r.miss_ratio(4) == 4.0 / 64);
+
+    auto const curve = r.miss_ratio_curve(8);
+    expect(curve.size() == 9);
+    expect(curve[2] == 1.0);
+    expect(curve[8] == 4.0 / 64);
+
+    // Windows larger than the cycle account for cold accesses as if they had infinite intervals.
+    expect(r.working_set_size(1) == 1.0);
+    expect(r.working_set_size(4) == 4.0);
+    expect(r.working_set_size(16) == 4.0 + 12 * (4.0 / 64));
+  };
+
+  "reuse_profile_sampling"_test = [] {
+    // Generate a trace from a LRU stack model, so that no page is more popular than the others and
+    // any sample of the pages has the same reuse distances as the whole trace.
+    std::mt19937 g(1);
+    std::vector<std::uint16_t> stack;
+    for (std::uint16_t p = 16; p < 240; ++p) { stack.push_back(p); }
+    std::geometric_distribution<std::size_t> distance(1.0 / 24);
+    Trace trace;
+    for (auto i = 0; i < 20000; ++i) {
+      auto const d = std::min(distance(g), stack.size() - 1);
+      auto const p = stack[d];
+      stack.erase(stack.begin() + static_cast<std::ptrdiff_t>(d));
+      stack.insert(stack.begin(), p);
+      trace.push_back({static_cast<std::uint16_t>(p << 8), PageEntry::read});
+    }
+
+    auto const reference = profile(trace);
+    auto const exact = reference.miss_ratio_curve(224);
+    for (auto const rate : {0.5, 0.25}) {
+      auto const r = profile(trace, rate);
+      expect(r.rate() == rate);
+
+      // Sampled accesses are scaled back to the size of the trace.
+      expect(std::abs(r.total - 20000) < 20000 * 0.15) << "rate" << rate;
+      expect(std::abs(r.cold - reference.cold) < reference.cold * 0.25) << "rate" << rate;
+
+      // The sampled curve follows the exact one.
+      auto const curve = r.miss_ratio_curve(224);
+      double error = 0;
+      for (std::size_t k = 0; k < curve.size(); ++k) { error += std::abs(curve[k] - exact[k]); }
+      expect(error / curve.size() < 0.02) << "rate" << rate;
+    }
+  };
+
+  "invariants"_test = [] {
+    Machine m;
+    expect(nothrow([&] { check_invariants(m); }));
+
+    auto const va = m.simple_mmap(0, 4096, PageEntry::read | PageEntry::write);
+    m.translate(va, PageEntry::read);
+    expect(nothrow([&] { check_invariants(m); }));
+
+    // Corrupt the back reference of the frame storing the first page.
+    auto const f = m.lookup_entry(va)->frame();
+    m.frame_table()[f].clear_back_references();
+    expect(throws<InvariantViolation>([&] { check_invariants(m); }));
+  };
+
+  "differential"_test = [] {
+    for (std::uint32_t seed = 0; seed < 16; ++seed) {
+      std::mt19937 g(seed);
+      std::vector<std::uint8_t> input(8192);
+      std::generate(input.begin(), input.end(), [&] { return static_cast<std::uint8_t>(g()); });
+
+      DifferentialDriver d;
+      try {
+        d.run(input);
+      } catch (InvariantViolation const& e) {
+        expect(false) << "seed" << seed << ":" << e.what();
+      }
+    }
+  };
+
+  "kernel_heap"_test = [] {
+    Machine m;
+
+    // Map one page every 2KB, which requires a directory for each mapping.
+    std::vector<VirtualAddress> pages;
+    for (std::uint16_t a = 0x0800; a < 0xf800; a += 0x0800) {
+      pages.push_back(m.simple_mmap(a, 256, PageEntry::read | PageEntry::write));
+      expect(pages.back().raw == a);
+    }
+    expect(m.klimit() > 0x0100);
+    expect(nothrow([&] { check_invariants(m); }));
+
+    // Unmapping releases the directories, which are recycled by subsequent mappings.
+    auto const brk = m.kbrk();
+    for (auto va : pages) { m.simple_munmap(va, 256); }
+    expect(nothrow([&] { check_invariants(m); }));
+    expect(throws([&] { m.translate(pages.front(), PageEntry::read); }));
+
+    for (auto va : pages) { m.simple_mmap(va, 256, PageEntry::read); }
+    expect(m.kbrk() == brk);
+    expect(nothrow([&] { check_invariants(m); }));
+  };
+
+  "wide_address_space"_test = [] {
+    using G = Geometry48;
+    using Error = WideMachine<G>::LookupError;
+    WideMachine<G> m;
+
+    // A stack at the top of the address space, a heap at the bottom, and a sparse mapping between.
+    auto const rw = PageEntry::read | PageEntry::write;
+    auto const stack = m.mmap(G::size - 64 * G::page_size, 64 * G::page_size, rw);
+    auto const heap = m.mmap(0, 32 * G::page_size, rw);
+    auto const code = m.mmap(0x7f0000000000, G::page_size, PageEntry::read | PageEntry::execute);
+    expect(stack == G::size - 64 * G::page_size);
+    expect(heap == 16 * G::page_size);
+    expect(code == 0x7f0000000000);
+
+    // Touch more pages than there are frames so that some of them are swapped out.
+    std::vector<std::uint64_t> pages;
+    for (std::uint64_t i = 0; i < 24; ++i) {
+      pages.push_back(stack + i * G::page_size);
+      pages.push_back(heap + i * G::page_size);
+    }
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+      m.store_byte(std::byte(i), m.translate(pages[i] + 7, PageEntry::write));
+    }
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+      expect(m.read_byte(m.translate(pages[i] + 7, PageEntry::read)) == std::byte(i));
+    }
+    expect(m.secondary_memory.size() > G::page_size);
+
+    // Only the directories on the paths to the touched pages are allocated.
+    expect(m.table.footprint() < 16 * 512 * sizeof(std::uint64_t));
+
+    // Faults.
+    expect(throws<Error>([&] { m.translate(0, PageEntry::read); }));
+    expect(throws<Error>([&] { m.translate(0x100000000, PageEntry::read); }));
+    expect(throws<Error>([&] { m.translate(code, PageEntry::write); }));
+
+    // Unmapping releases the pages and the directories.
+    m.munmap(heap, 32 * G::page_size);
+    m.munmap(stack, 64 * G::page_size);
+    m.munmap(code, G::page_size);
+    expect(throws<Error>([&] { m.translate(heap, PageEntry::read); }));
+    expect(m.table.footprint() == 512 * sizeof(void*));
+
+    // A 32-bit address space with a two-level table.
+    WideMachine<Geometry32> n;
+    auto const top = n.mmap(0xfffff000, 0x1000, PageEntry::read | PageEntry::write);
+    expect(top == 0xfffff000u);
+    n.store_byte(std::byte{42}, n.translate(0xffffffff, PageEntry::write));
+    expect(n.read_byte(n.translate(0xffffffff, PageEntry::read)) == std::byte{42});
+    expect(n.mmap(0xfffff000, 0x2000, PageEntry::read) == 0x1000u);
+  };
+
+  "hashed_page_table"_test = [] {
+    using G = Geometry48;
+    WideMachine<G> r;
+    WideMachine<G, HashedPageTable> h;
+
+    // Scatter pages across the address space, touching more pages than there are frames.
+    std::mt19937_64 g(0);
+    std::vector<std::uint64_t> pages;
+    for (std::size_t i = 0; i < 64; ++i) {
+      auto const va = G::page(static_cast<std::uint64_t>(g()) % (G::size - G::page_size));
+      if ((va == 0) || r.overlapping(va, va + G::page_size) != r.regions.end()) { continue; }
+      r.store_byte(std::byte(i), r.allocate_page(va, PageEntry::read | PageEntry::write));
+      h.store_byte(std::byte(i), h.allocate_page(va, PageEntry::read | PageEntry::write));
+      pages.push_back(va);
+    }
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+      auto const b = r.read_byte(r.translate(pages[i], PageEntry::read));
+      expect(h.read_byte(h.translate(pages[i], PageEntry::read)) == b);
+    }
+
+    // The inverted table is proportional to the number of pages, not to the size of the space,
+    // and is probed fewer times than there are levels in the radix tree.
+    expect(h.table.footprint() < r.table.footprint());
+    expect(h.table.steps < r.table.steps);
+
+    // Unmapping removes both resident and swapped out pages.
+    for (auto va : pages) { h.munmap(static_cast<G::address_type>(va), G::page_size); }
+    expect(h.table.swapped.empty());
+    expect(std::ranges::all_of(h.table.anchors, [](auto a) { return a == 0; }));
+    expect(throws([&] { h.translate(pages.front(), PageEntry::read); }));
+  };
+
+  "mmap_file"_test = [] {
+    // Create a file of three pages and a half.
+    auto const path = std::filesystem::temp_directory_path() / "mmu-mmap-file.bin";
+    {
+      std::ofstream o(path, std::ios::binary);
+      for (std::size_t i = 0; i < 896; ++i) { o.put(static_cast<char>(i / 256 + 1)); }
+    }
+
+    Machine m;
+    auto const f = m.open_file(path.string());
+    auto const a = m.mmap_file(0, 1024, PageEntry::read | PageEntry::write, f, 0);
+    auto const b = m.mmap_file(0, 512, PageEntry::read, f, 256);
+    expect(nothrow([&] { check_invariants(m); }));
+
+    // A page can be mapped at most twice.
+    expect(throws<std::invalid_argument>([&] { m.mmap_file(0, 512, PageEntry::read, f, 512); }));
+    auto const d = m.mmap_file(0, 256, PageEntry::read, f, 768);
+    m.simple_munmap(d, 256);
+
+    // Pages are read on first touch and shared between the mappings.
+    auto const pa = m.translate(a.advanced(0x100), PageEntry::read);
+    expect(m.read_byte(pa) == std::byte{2});
+    expect(m.translate(b, PageEntry::read).raw == pa.raw);
+    expect(m.page_cache_statistics.misses == 1);
+    expect(m.page_cache_statistics.hits == 1);
+    expect(m.read_byte(m.translate(a.advanced(0x380), PageEntry::read)) == std::byte{0});
+    expect(throws([&] { m.translate(b, PageEntry::write); }));
+
+    // Writes are visible through both mappings and written back when the frame is evicted.
+    m.store_byte(std::byte{42}, m.translate(a.advanced(0x100), PageEntry::write));
+    expect(m.read_byte(m.translate(b, PageEntry::read)) == std::byte{42});
+    auto const anonymous = m.simple_mmap(0, 16 * 256, PageEntry::read | PageEntry::write);
+    expect(m.page_cache_statistics.writebacks == 1);
+    expect(nothrow([&] { check_invariants(m); }));
+    m.files[f].stream.flush();
+    {
+      std::ifstream i(path, std::ios::binary);
+      i.seekg(256);
+      expect(i.get() == 42);
+    }
+
+    // The page is read again after its eviction.
+    expect(m.read_byte(m.translate(b, PageEntry::read)) == std::byte{42});
+    expect(m.page_cache_statistics.misses == 3);
+    expect(nothrow([&] { check_invariants(m); }));
+
+    // Unmapping keeps the frames in the page cache.
+    m.simple_munmap(anonymous, 16 * 256);
+    m.simple_munmap(a, 1024);
+    m.simple_munmap(b, 512);
+    expect(nothrow([&] { check_invariants(m); }));
+    auto const c = m.mmap_file(0, 256, PageEntry::read, f, 256);
+    expect(m.read_byte(m.translate(c, PageEntry::read)) == std::byte{42});
+    expect(m.page_cache_statistics.hits == 2);
+
+    std::filesystem::remove(path);
+  };
+
+  "compressed_swap"_test = [] {
+    // Compression round-trips.
+    std::mt19937 g(1);
+    std::vector<std::uint8_t> compressed;
+    for (auto fill : {0, 1, 2}) {
+      std::array<std::byte, 256> page = {};
+      for (std::size_t i = 0; i < page.size(); ++i) {
+        page[i] = std::byte(fill == 0 ? 0 : (fill == 1 ? (i / 7) : g()));
+      }
+      lz_compress(page, compressed);
+      std::array<std::byte, 256> copy = {};
+      lz_decompress(compressed, copy);
+      expect(std::ranges::equal(copy, page));
+    }
+
+    Machine m;
+    m.compressed_pool = CompressedPool(600);
+    auto const va = m.simple_mmap(0, 32 * 256, PageEntry::read | PageEntry::write);
+
+    // Write pages starting with 64 random bytes, which compress to about 70 bytes, and 4 pages
+    // full of random bytes, which do not compress.
+    auto const page_at = [&](std::size_t p) {
+      return va.advanced(static_cast<std::uint16_t>(p << 8));
+    };
+    std::vector<std::uint8_t> expected(32 * 64);
+    for (std::size_t p = 0; p < 32; ++p) {
+      std::size_t const n = (p < 4) ? 256 : 64;
+      for (std::size_t i = 0; i < n; ++i) {
+        auto const b = static_cast<std::uint8_t>(g());
+        if (i < 64) { expected[p * 64 + i] = b; }
+        m.store_byte(std::byte{b}, m.translate(page_at(p).advanced(i), PageEntry::write));
+      }
+    }
+    for (std::size_t p = 0; p < 32; ++p) {
+      for (std::size_t i = 0; i < 64; ++i) {
+        auto const b = m.read_byte(m.translate(page_at(p).advanced(i), PageEntry::read));
+        expect(b == std::byte{expected[p * 64 + i]});
+      }
+    }
+    expect(nothrow([&] { check_invariants(m); }));
+
+    auto const& s = m.compressed_pool.statistics;
+    expect(s.stores > 0);
+    expect(s.rejects > 0);
+    expect(s.spills > 0);
+    expect(s.pool_hits > 0);
+    expect(s.secondary_hits > 0);
+    expect(s.compression_ratio() > 3.0);
+    expect(m.compressed_pool.used <= 600);
+  };
+
+  "latency"_test = [] {
+    Machine m;
+    auto const& model = m.cost_model;
+
+    // Core 0 replays a trace whose pages fit in the TLB.
+    Trace small;
+    for (std::uint16_t i = 0; i < 256; ++i) {
+      auto const va = static_cast<std::uint16_t>(0x1000 + ((i % 4) << 8));
+      small.push_back({VirtualAddress(va), PageEntry::read});
+    }
+    replay(m, small);
+    expect(m.latency.last_access == model[Event::tlb_lookup] + model[Event::memory_access]);
+
+    // Core 1 replays a trace whose pages do not fit in main memory.
+    m.core = 1;
+    Trace large;
+    for (std::uint16_t i = 0; i < 256; ++i) {
+      auto const va = static_cast<std::uint16_t>(0x2000 + ((i % 24) << 8));
+      large.push_back({VirtualAddress(va), PageEntry::read});
+    }
+    replay(m, large);
+
+    auto const& c0 = m.latency.cores[0];
+    auto const& c1 = m.latency.cores[1];
+    expect(c0.accesses == 256);
+    expect(c1.accesses == 256);
+    expect(c0.count(Event::swap_read) == 0);
+    expect(c1.count(Event::swap_read) > 0);
+    expect(c0.amat() < 2 * (model[Event::tlb_lookup] + model[Event::memory_access]));
+    expect(c1.amat() > model[Event::swap_read] / 2);
+    expect(m.latency.total().cycles == c0.cycles + c1.cycles);
+  };
+
+  "data_cache"_test = [] {
+    Machine m;
+    m.caches.l1 = Cache({.line_size = 16, .set_count = 4, .associativity = 2});
+    m.caches.l2 = Cache({.line_size = 32, .set_count = 16, .associativity = 4});
+    auto const va = m.simple_mmap(0, 1024, PageEntry::read | PageEntry::write);
+    auto const at = [&](std::size_t i) { return va.advanced(static_cast<std::uint16_t>(i)); };
+
+    // A sequential scan misses once per line.
+    for (std::size_t i = 0; i < 256; ++i) { m.read_byte(m.translate(at(i), PageEntry::read)); }
+    expect(m.caches.l1.statistics.read_misses == 16);
+    expect(m.caches.l1.statistics.read_hits == 240);
+    expect(m.caches.l2.statistics.read_misses == 8);
+
+    // A loop over 128 bytes fits in L1, whose accesses cost a TLB lookup and an L1 access.
+    for (std::size_t k = 0; k < 4; ++k) {
+      for (std::size_t i = 0; i < 128; ++i) { m.read_byte(m.translate(at(i), PageEntry::read)); }
+    }
+    auto const& model = m.cost_model;
+    expect(m.latency.last_access == model[Event::tlb_lookup] + model[Event::l1_access]);
+
+    // Writes make lines dirty, which are written back when evicted.
+    for (std::size_t i = 0; i < 1024; ++i) {
+      m.store_byte(std::byte{1}, m.translate(at(i), PageEntry::write));
+    }
+    expect(m.caches.l1.statistics.writebacks > 0);
+    expect(m.read_byte(m.translate(at(1000), PageEntry::read)) == std::byte{1});
+
+    // A loop over 1KB misses in L1 but fits in L2.
+    auto const misses = m.caches.l2.statistics.read_misses + m.caches.l2.statistics.write_misses;
+    for (std::size_t k = 0; k < 2; ++k) {
+      for (std::size_t i = 0; i < 1024; i += 16) {
+        m.read_byte(m.translate(at(i), PageEntry::read));
+      }
+    }
+    expect(m.caches.l2.statistics.read_misses + m.caches.l2.statistics.write_misses == misses);
+  };
+
+  "frame_placement"_test = [] {
+    auto const rw = PageEntry::read | PageEntry::write;
+    auto const frame_of = [](Machine& m, VirtualAddress va) {
+      return static_cast<std::size_t>(m.lookup_entry(va)->frame());
+    };
+
+    // Page coloring maps consecutive pages to frames of consecutive colors.
+    {
+      Machine m;
+      m.frame_policy.kind = FrameAllocationPolicy::Kind::coloring;
+      m.frame_policy.color_count = FrameAllocationPolicy::color_count_of(1024);
+      expect(m.frame_policy.color_count == 4);
+      auto const va = m.simple_mmap(0x1000, 8 * 256, rw);
+      for (std::uint16_t i = 0; i < 8; ++i) {
+        auto const page = va.advanced(static_cast<std::uint16_t>(i << 8));
+        expect(frame_of(m, page) % 4 == (page.raw >> 8) % 4);
+      }
+      expect(m.frame_policy.statistics.color_misses == 0);
+    }
+
+    // NUMA placement allocates frames on the node of the core, then on the nearest node.
+    {
+      Machine m;
+      m.frame_policy.kind = FrameAllocationPolicy::Kind::numa;
+      m.frame_policy.node_count = 2;
+      m.core = 1;
+      auto const va = m.simple_mmap(0, 10 * 256, rw);
+      for (std::uint16_t i = 0; i < 8; ++i) {
+        expect(frame_of(m, va.advanced(static_cast<std::uint16_t>(i << 8))) >= 8);
+      }
+      expect(frame_of(m, va.advanced(0x900)) < 8);
+      expect(m.frame_policy.statistics.remote_allocations == 2);
+
+      // Accesses to remote frames are more expensive.
+      auto const remote = m.latency.cores[1].count(Event::remote_memory_access);
+      m.translate(va.advanced(0x900), PageEntry::read);
+      expect(m.latency.cores[1].count(Event::remote_memory_access) == remote + 1);
+      m.translate(va, PageEntry::read);
+      expect(m.latency.cores[1].count(Event::remote_memory_access) == remote + 1);
+    }
+
+    // Interleaving alternates between nodes.
+    {
+      Machine m;
+      m.frame_policy.kind = FrameAllocationPolicy::Kind::interleave;
+      m.frame_policy.node_count = 2;
+      auto const va = m.simple_mmap(0, 4 * 256, rw);
+      for (std::uint16_t i = 0; i < 4; ++i) {
+        auto const f = frame_of(m, va.advanced(static_cast<std::uint16_t>(i << 8)));
+        expect(m.frame_policy.node_of_frame(f) == i % 2);
+      }
+      expect(m.frame_policy.statistics.allocations[0] == 2);
+      expect(m.frame_policy.statistics.allocations[1] == 2);
+      expect(nothrow([&] { check_invariants(m); }));
+    }
+  };
+
+  "background_reclaim"_test = [] {
+    // Touch 32 pages in a loop, first with direct reclaim only, then with the reclaim daemon.
+    Trace trace;
+    for (std::uint16_t k = 0; k < 4; ++k) {
+      for (std::uint16_t i = 0; i < 32; ++i) {
+        auto const va = static_cast<std::uint16_t>(0x1000 + (i << 8));
+        trace.push_back({VirtualAddress(va), PageEntry::read});
+      }
+    }
+
+    Machine direct;
+    replay(direct, trace);
+    expect(direct.reclaim_statistics.direct > 0);
+    expect(direct.reclaim_statistics.background == 0);
+
+    Machine m;
+    m.watermarks = {.low = 2, .high = 4};
+    replay(m, trace);
+    expect(nothrow([&] { check_invariants(m); }));
+    expect(m.reclaim_statistics.wakeups > 0);
+    expect(m.reclaim_statistics.background > 0);
+    expect(m.reclaim_statistics.direct == 0);
+    expect(m.reclaim_statistics.background_cycles > 0);
+    expect(m.free_frame_count() >= 1);
+
+    // Eviction is off the critical path of the faults.
+    expect(m.latency.total().cycles < direct.latency.total().cycles);
+  };
+
+  "large_pages"_test = [] {
+    auto const rw = PageEntry::read | PageEntry::write;
+    auto const pattern = [](std::uint16_t i) { return std::byte((i * 7) ^ (i >> 8)); };
+    auto const check = [&](Machine& m, VirtualAddress va, std::uint16_t length) {
+      for (std::uint16_t i = 0; i < length; ++i) {
+        auto const pa = m.translate(va.advanced(i), PageEntry::read);
+        if (m.read_byte(pa) != pattern(i)) { return false; }
+      }
+      return true;
+    };
+
+    // Fragment memory with a small mapping, part of which is unmapped afterward.
+    Machine m;
+    auto const small = m.simple_mmap(0x4000, 4 * 256, rw);
+    auto const va = m.simple_mmap(0x1000, 8 * 256, rw);
+    m.simple_munmap(small, 2 * 256);
+    for (std::uint16_t i = 0; i < 8 * 256; ++i) {
+      m.store_byte(pattern(i), m.translate(va.advanced(i), PageEntry::write));
+    }
+
+    expect(m.collapse_large_page(va));
+    expect(nothrow([&] { check_invariants(m); }));
+    expect(m.compaction_statistics.migrations > 0);
+    expect(m.find_large_page(va.advanced(0x0500)) == m.lookup_entry(va));
+    expect(check(m, va, 8 * 256));
+
+    // The pages are stored in consecutive frames.
+    auto const base = m.translate(va, PageEntry::read).raw >> 8;
+    for (std::uint16_t i = 0; i < 8; ++i) {
+      auto const pa = m.translate(va.advanced(static_cast<std::uint16_t>(i << 8)), 0);
+      expect((pa.raw >> 8) == base + i);
+    }
+
+    // No other range can be collapsed and there are no frames left for another large page.
+    expect(m.khugepaged() == 0);
+    expect(throws<std::bad_alloc>([&] { m.compact(8); }));
+
+    // Unmapping part of the large page splits it.
+    m.simple_munmap(va.advanced(0x0700), 256);
+    expect(m.compaction_statistics.splits == 1);
+    expect(m.find_large_page(va) == nullptr);
+    expect(nothrow([&] { check_invariants(m); }));
+    expect(check(m, va, 7 * 256));
+
+    // Collapsing a range whose pages have been swapped out brings them back.
+    Machine n;
+    auto const a = n.simple_mmap(0x1000, 8 * 256, rw);
+    auto const b = n.simple_mmap(0x2000, 8 * 256, rw);
+    for (auto const r : {a, b}) {
+      for (std::uint16_t i = 0; i < 8 * 256; ++i) {
+        n.store_byte(pattern(i), n.translate(r.advanced(i), PageEntry::write));
+      }
+    }
+    expect(n.khugepaged() == 1);
+    expect(n.find_large_page(a) != nullptr);
+    expect(nothrow([&] { check_invariants(n); }));
+    expect(check(n, a, 8 * 256));
+    expect(check(n, b, 8 * 256));
+    expect(nothrow([&] { check_invariants(n); }));
+  };
+
+  "tlb_prefetch"_test = [] {
+    // Scan 8 pages sequentially several times, which misses the TLB on every page without
+    // prefetching since the TLB only holds 4 translations.
+    auto const scan = [](Machine& m) {
+      auto const va = m.simple_mmap(0x1000, 8 * 256, PageEntry::read | PageEntry::write);
+      m.latency = {};
+      for (std::size_t k = 0; k < 4; ++k) {
+        for (std::uint16_t i = 0; i < 8 * 256; ++i) {
+          m.translate(va.advanced(i), PageEntry::read);
+        }
+      }
+      return m.latency.total().count(Event::walk_step) / 3;
+    };
+
+    Machine baseline;
+    expect(scan(baseline) == 32_u);
+
+    // Each pass only misses until the stride of the stream is confirmed.
+    Machine m;
+    m.tlb_prefetcher.depth = 2;
+    auto const misses = scan(m);
+    auto const& s = m.tlb_prefetcher.statistics;
+    expect(nothrow([&] { check_invariants(m); }));
+    expect(misses <= 12_u);
+    expect(s.useful >= 20_u);
+    expect(s.useful + s.wasted <= s.prefetches);
+    expect(s.accuracy() > 0.9);
+  };
+
+  "guard_pages_and_pkeys"_test = [] {
+    auto const rw = PageEntry::read | PageEntry::write;
+    auto const cause_of = [](auto&& action) {
+      try {
+        action();
+      } catch (PageLookupError const& e) {
+        return int(e.cause);
+      }
+      return 0;
+    };
+
+    // Guard pages surround the mapping and fault without reaching secondary memory.
+    Machine m;
+    auto const va = m.simple_mmap(0x2000, 512, rw, 1);
+    expect(va.raw == 0x2000);
+    m.latency = {};
+    expect(cause_of([&] { m.translate(va.advanced(0xffff), PageEntry::read); }) == GuardFault);
+    expect(cause_of([&] { m.translate(va.advanced(0x0200), 0); }) == GuardFault);
+    expect(m.latency.total().count(Event::fault) == 0_u);
+    expect(m.simple_mmap(0x1f00, 256, rw).raw != 0x1f00);
+    expect(nothrow([&] { check_invariants(m); }));
+
+    // Keys restrict accesses per core without touching the TLB.
+    auto const k = m.pkey_alloc();
+    expect(k == 1_i);
+    m.pkey_mprotect(va, 512, k);
+    m.store_byte(std::byte{42}, m.translate(va, PageEntry::write));
+    auto const walks = m.latency.total().count(Event::walk_step);
+    m.pkey_set(k, Machine::pkey_disable_write);
+    expect(cause_of([&] { m.translate(va, PageEntry::write); }) == ProtectionKeyFault);
+    expect(m.read_byte(m.translate(va, PageEntry::read)) == std::byte{42});
+    expect(m.tlb.contains(va.raw));
+    expect(m.latency.total().count(Event::walk_step) == walks);
+
+    m.pkey_set(k, Machine::pkey_disable_access);
+    expect(cause_of([&] { m.translate(va.advanced(0x0100), PageEntry::read); })
+      == ProtectionKeyFault);
+    m.core = 1;
+    expect(cause_of([&] { m.translate(va.advanced(0x0100), PageEntry::write); }) == 0);
+    m.core = 0;
+    m.pkey_set(k, 0);
+    expect(cause_of([&] { m.translate(va, PageEntry::write); }) == 0);
+
+    // Unmapping the guard pages together with the mapping resets the keys of its pages.
+    m.simple_munmap(va.advanced(0xff00), 4 * 256);
+    expect(m.page_keys[va.raw >> 8] == 0_i);
+    expect(!m.is_mapped(va.advanced(0xff00)) && !m.is_mapped(va.advanced(0x0200)));
+    expect(nothrow([&] { check_invariants(m); }));
+    m.pkey_free(k);
+    expect(m.pkey_alloc() == k);
+  };
+
+  "user_faults"_test = [] {
+    auto const rw = PageEntry::read | PageEntry::write;
+
+    // Load the pages of a region lazily, filling each with its page number.
+    Machine m;
+    std::vector<std::uint16_t> loaded;
+    m.register_fault_handler(0x3000, 4 * 256, Machine::uffd_missing, [&](
+      Machine& self, Machine::UserFault const& f
+    ) {
+      auto const page = f.address.page();
+      std::array<std::byte, 256> contents;
+      contents.fill(std::byte(page.raw >> 8));
+      self.uffd_copy(page, contents, rw);
+      loaded.push_back(page.raw);
+    });
+
+    expect(m.read_byte(m.translate(0x3142, PageEntry::read)) == std::byte{0x31});
+    expect(m.read_byte(m.translate(0x3100, PageEntry::read)) == std::byte{0x31});
+    expect(m.read_byte(m.translate(0x3310, PageEntry::read)) == std::byte{0x33});
+    expect(loaded == std::vector<std::uint16_t>{0x3100, 0x3300});
+    expect(m.user_fault_statistics.missing == 2_u);
+    expect(throws<PageLookupError>([&] { m.translate(0x3400, PageEntry::read); }));
+    expect(throws<std::invalid_argument>([&] {
+      m.register_fault_handler(0x3300, 256, Machine::uffd_missing, {});
+    }));
+
+    // Track the pages written since a snapshot with write protection.
+    auto const va = m.simple_mmap(0x5000, 4 * 256, rw);
+    std::vector<std::uint16_t> dirty;
+    m.register_fault_handler(va, 4 * 256, Machine::uffd_write_protect_mode, [&](
+      Machine& self, Machine::UserFault const& f
+    ) {
+      dirty.push_back(f.address.page().raw);
+      self.uffd_write_protect(f.address.page(), 256, false);
+    });
+    m.uffd_write_protect(va, 4 * 256, true);
+    expect(nothrow([&] { check_invariants(m); }));
+
+    m.translate(va.advanced(0x0100), PageEntry::read);
+    m.store_byte(std::byte{1}, m.translate(va.advanced(0x0210), PageEntry::write));
+    m.store_byte(std::byte{2}, m.translate(va.advanced(0x0220), PageEntry::write));
+    expect(dirty == std::vector<std::uint16_t>{static_cast<std::uint16_t>(va.raw + 0x0200)});
+    expect(m.user_fault_statistics.write_protect == 1_u);
+    expect(nothrow([&] { check_invariants(m); }));
+
+    // Faults outside of registered modes are not delivered.
+    m.unregister_fault_handler(va);
+    expect(throws<PageLookupError>([&] { m.translate(va, PageEntry::write); }));
+    m.simple_munmap(va, 4 * 256);
+    expect(!m.write_protected[va.raw >> 8]);
+    expect(nothrow([&] { check_invariants(m); }));
+  };
+
+  "shadow_table"_test = [] {
+    // Touch 12 pages round-robin, which misses the TLB on every page.
+    auto const run = [](Machine& m) {
+      auto const va = m.simple_mmap(0x1000, 12 * 256, PageEntry::read | PageEntry::write);
+      for (std::size_t k = 0; k < 4; ++k) {
+        for (std::uint16_t i = 0; i < 12; ++i) {
+          auto const a = va.advanced(static_cast<std::uint16_t>(i << 8));
+          m.store_byte(std::byte(i + k), m.translate(a, PageEntry::write));
+        }
+      }
+      return m.latency.total().count(Event::walk_step);
+    };
+
+    Machine baseline;
+    auto const baseline_steps = run(baseline);
+    Machine m;
+    m.shadow.enabled = true;
+    auto const steps = run(m);
+    expect(steps * 2 < baseline_steps);
+    expect(m.shadow.hits > 0_u);
+    expect(nothrow([&] { check_invariants(m); }));
+
+    // Entries are cleared when the entries they refer to are removed or moved.
+    expect(m.shadow.entries[0x12] != 0);
+    m.simple_munmap(0x1200, 256);
+    expect(m.shadow.entries[0x12] == 0);
+    expect(throws<PageLookupError>([&] { m.translate(0x1200, PageEntry::read); }));
+
+    m.simple_munmap(0x1800, 4 * 256);
+    expect(m.collapse_large_page(0x1000) == false);
+    m.uffd_zeropage(0x1200, PageEntry::read | PageEntry::write);
+    expect(m.collapse_large_page(0x1000));
+    expect(m.shadow.entries[0x13] == 0);
+    m.translate(0x1300, PageEntry::read);
+    expect((m.shadow.entries[0x13] & 1) == 1);
+    expect(nothrow([&] { check_invariants(m); }));
+    m.simple_munmap(0x1700, 256);
+    expect(nothrow([&] { check_invariants(m); }));
+    for (std::uint16_t i = 0; i < 7; ++i) {
+      auto const a = static_cast<std::uint16_t>(0x1000 + (i << 8));
+      auto const expected = (i == 2) ? std::byte{0} : std::byte(i + 3);
+      expect(m.read_byte(m.translate(a, PageEntry::read)) == expected);
+    }
+  };
+
+  "associative_tlb"_test = [] {
+    // Compare with a reference LRU cache on random operations, for several key widths.
+    auto const check = [&]<typename Key>(Key) {
+      AssociativeTLB<Key, std::uint64_t, 40> tlb;
+      std::vector<std::pair<Key, std::uint64_t>> reference;
+      std::mt19937 random(42);
+      for (std::size_t n = 0; n < 4000; ++n) {
+        auto const key = static_cast<Key>((random() % 64 + 1) * 0x11);
+        auto const value = std::uint64_t{key} * 3 + 1;
+        auto const r = std::ranges::find(reference, key, [](auto const& e) { return e.first; });
+        auto const hit = r != reference.end();
+        if (random() % 8 == 0) {
+          tlb.invalidate(value);
+          if (hit) { reference.erase(r); }
+        } else if (tlb.lookup(key) != (hit ? value : 0)) {
+          return false;
+        } else if (hit) {
+          std::rotate(reference.begin(), r, r + 1);
+        } else {
+          tlb.insert(key, value);
+          reference.insert(reference.begin(), {key, value});
+          if (reference.size() > 40) { reference.pop_back(); }
+        }
+      }
+      return true;
+    };
+    expect(check(std::uint16_t{}));
+    expect(check(std::uint32_t{}));
+    expect(check(std::uint64_t{}));
+
+    // A wide machine with a large associative TLB translates like the default one.
+    WideMachine<Geometry48> a;
+    WideMachine<Geometry48, RadixPageTable, 16, 64, AssociativeTLB> b;
+    auto const rw = PageEntry::read | PageEntry::write;
+    auto const va = a.mmap(0, 32 * 4096, rw);
+    expect(b.mmap(0, 32 * 4096, rw) == va);
+    for (std::uint64_t k = 0; k < 3; ++k) {
+      for (std::uint64_t i = 0; i < 32 * 4096; i += 512) {
+        a.store_byte(std::byte(i >> 9), a.translate(va + i, PageEntry::write));
+        b.store_byte(std::byte(i >> 9), b.translate(va + i, PageEntry::write));
+      }
+    }
+    for (std::uint64_t i = 0; i < 32 * 4096; i += 512) {
+      expect(b.read_byte(b.translate(va + i, PageEntry::read)) == std::byte(i >> 9));
+    }
+  };
+
+  "frame_bitmaps"_test = [] {
+    // Bit sets are searched and cleared across word boundaries.
+    FrameBitset<130> b;
+    for (std::size_t i : {3, 63, 64, 129}) { b.set(i); }
+    expect(b.count() == 4);
+    expect(b.find_next(4) == 63);
+    expect(b.find_next(65) == 129);
+    expect(b.find_next_clear(63) == 65);
+    b.clear_range(60, 129);
+    expect(b.find_next(4) == 129);
+    b.set(129, false);
+    expect(b.find_next(0) == 3);
+    expect(b.find_next(4) == 130);
+
+    // A wide machine with frames spanning several words evicts and reloads pages correctly.
+    using G = Geometry48;
+    WideMachine<G, RadixPageTable, 200> w;
+    auto const rw = PageEntry::read | PageEntry::write;
+    auto const va = w.mmap(0, 300 * G::page_size, rw);
+    for (std::uint64_t k = 0; k < 2; ++k) {
+      for (std::uint64_t i = 0; i < 300; ++i) {
+        w.store_byte(std::byte(i + k), w.translate(va + i * G::page_size, PageEntry::write));
+      }
+    }
+    expect(w.used_frames.count() == 200);
+    for (std::uint64_t i = 0; i < 300; ++i) {
+      expect(w.read_byte(w.translate(va + i * G::page_size, PageEntry::read)) == std::byte(i + 1));
+    }
+    w.munmap(va, 300 * G::page_size);
+    expect(w.used_frames.count() == 0);
+  };
+
+  "parameter_sweep"_test = [] {
+    // Save a trace touching 40 pages in a random order, and map it back.
+    std::mt19937 g(0);
+    Trace trace;
+    for (std::size_t i = 0; i < 2000; ++i) {
+      auto const va = static_cast<std::uint16_t>(0x1000 + ((g() % 40) << 8) + (g() & 0xff));
+      trace.push_back({VirtualAddress(va), (i % 3 == 0) ? PageEntry::write : PageEntry::read});
+    }
+    auto const path = (std::filesystem::temp_directory_path() / "mmu-sweep-trace.bin").string();
+    save_trace(path, trace);
+    MappedTrace mapped(path);
+    expect(mapped.accesses().size() == trace.size());
+
+    // Sweep over prefetch depths and watermarks, with more configurations than threads.
+    std::vector<SweepConfiguration> configurations;
+    for (std::size_t depth = 0; depth < 4; ++depth) {
+      for (std::size_t low = 0; low < 3; ++low) {
+        configurations.push_back({
+          "depth=" + std::to_string(depth) + ";low=" + std::to_string(low),
+          [=](Machine& m) {
+            m.tlb_prefetcher.depth = depth;
+            m.watermarks = {.low = low, .high = 2 * low};
+          }
+        });
+      }
+    }
+    auto const results = sweep(mapped.accesses(), configurations, 4);
+    expect(results.size() == configurations.size());
+
+    // Each result is the one of a sequential replay of the configuration.
+    for (std::size_t i = 0; i < configurations.size(); ++i) {
+      Machine m;
+      configurations[i].configure(m);
+      replay(m, trace);
+      expect(results[i].name == configurations[i].name);
+      expect(results[i].latency.accesses == trace.size());
+      expect(results[i].latency.cycles == m.latency.total().cycles);
+      expect(results[i].latency.events == m.latency.total().events);
+      expect(results[i].reclaim.background == m.reclaim_statistics.background);
+    }
+
+    // The table has a header and one row per configuration.
+    std::stringstream table;
+    write_sweep_table(table, results);
+    auto const rows = std::count(std::istreambuf_iterator<char>(table), {}, '\n');
+    expect(rows == static_cast<long>(configurations.size() + 1));
+
+    // Failures are reported once all configurations have been replayed.
+    configurations.push_back({"failing", [](Machine&) { throw std::invalid_argument("bad"); }});
+    expect(throws<std::invalid_argument>([&] { sweep(mapped.accesses(), configurations, 4); }));
+    std::filesystem::remove(path);
+  };
+
+  "page_heatmap"_test = [] {
+    // Replay the scenario of `main`, in which a page is evicted and swapped back in.
+    Machine m;
+    std::size_t intervals = 0;
+    m.heatmap.interval = 4;
+    m.heatmap.observer = [&](PageHeatmap const& h) { expect(h.clock == 4 * ++intervals); };
+
+    auto const rw = PageEntry::read | PageEntry::write;
+    m.allocate_page(0x0800, rw);
+    m.store_byte(std::byte{0x61}, m.translate(0x0850, PageEntry::write));
+    for (auto i = 0; i < 14; ++i) {
+      m.allocate_page(static_cast<std::uint16_t>(0x2000 + (i << 8)), rw);
+    }
+    m.allocate_page(0x3000, rw);
+    expect(m.read_byte(m.translate(0x0850, PageEntry::read)) == std::byte{0x61});
+    expect(intervals == m.heatmap.clock / 4);
+
+    // The page is evicted once and faults twice, and the page it displaces is evicted in turn.
+    auto const& page = m.heatmap.pages[0x08];
+    expect(page.reads == 1);
+    expect(page.writes == 2);
+    expect(page.faults == 2);
+    expect(page.evictions == 1);
+    expect(m.heatmap.pages[0x20].evictions == 1);
+    expect(m.heatmap.age(0x08) == 0);
+    expect(m.heatmap.classify(0x08) == Temperature::hot);
+    expect(m.heatmap.classify(0x40) == Temperature::cold);
+
+    // Pages age as other pages are accessed.
+    for (auto k = 0; k < 20; ++k) { m.translate(0x3000, PageEntry::read); }
+    expect(m.heatmap.classify(0x08) == Temperature::warm);
+    m.heatmap.cold_age = 20;
+    expect(m.heatmap.classify(0x08) == Temperature::cold);
+
+    // The counters are dumped with one row per touched page.
+    std::stringstream csv;
+    csv << std::hex << std::showbase;
+    auto const flags = csv.flags();
+    m.heatmap.write_csv(csv);
+    expect(csv.flags() == flags);
+    auto const text = csv.str();
+    auto const row = text.find("\n0x3000,");
+    expect(row != std::string::npos);
+
+    // Counters are written in decimal whatever the base of the stream.
+    auto const counters = text.substr(row + 8, text.find('\n', row + 1) - row - 8);
+    expect(counters.find("0x") == std::string::npos);
+    auto const rows = std::count(std::istreambuf_iterator<char>(csv), {}, '\n');
+    expect(rows == 1 + 16);
+    std::stringstream grid;
+    m.heatmap.write_grid(grid);
+    expect(grid.str().find("0x3000 @") != std::string::npos);
+
+    // Resetting the counters keeps the temperature of the pages.
+    m.heatmap.reset_counters();
+    expect(m.heatmap.pages[0x30].accesses() == 0);
+    expect(m.heatmap.classify(0x30) == Temperature::hot);
+  };
+
+  "address_formatting"_test = [] {
+    // Addresses are formatted into buffers and written to the given stream only.
+    char text[address_width];
+    expect(std::string_view(text, format_address(text, 0xf80a)) == "0xf80a");
+    std::stringstream o;
+    o << std::dec << std::setfill('*') << VirtualAddress{0x0042} << ' ' << PhysicalAddress{0x1000};
+    o << ' ' << 255;
+    expect(o.str() == "0x0042 0x1000 255");
+
+    // Tables are dumped one entry per line.
+    Machine m;
+    m.allocate_page(0x0800, PageEntry::read | PageEntry::write);
+    std::stringstream page_table;
+    dump_page_table(page_table, m);
+    expect(page_table.str().find("0x0800 L2 ") != std::string::npos);
+    expect(page_table.str().find(" prw--- ") != std::string::npos);
+
+    std::stringstream tlb;
+    dump_tlb(tlb, m);
+    expect(tlb.str().starts_with("0x0800 "));
+
+    std::stringstream frames;
+    dump_frame_table(frames, m);
+    auto const lines = std::count(std::istreambuf_iterator<char>(frames), {}, '\n');
+    expect(lines == 16);
+    expect(frames.str().starts_with("0 used -p 0 "));
+
+    // Buffers larger than a block are flushed in several writes.
+    std::stringstream large;
+    {
+      TextBuffer b(large);
+      for (std::uint32_t a = 0; a < 0x10000; ++a) { b.address(static_cast<std::uint16_t>(a)); }
+    }
+    expect(large.str().size() == 0x10000 * address_width);
+    expect(large.str().ends_with("0xfffe0xffff"));
+  };
+
+  "swap_devices"_test = [] {
+    // Two fast devices of equal priority, striped, and a slow one receiving the overflow.
+    Machine m;
+    expect(m.add_swap_device(2, 4, 100, 8.0) == 0);
+    expect(m.add_swap_device(2, 4, 100, 8.0) == 1);
+    expect(m.add_swap_device(1, 100, 10000, 0.5) == 2);
+    expect(throws<std::invalid_argument>([&] { m.add_swap_device(0, 1000, 1, 1.0); }));
+    auto const& devices = m.swap_devices.devices;
+    auto const& nvme0 = devices[0];
+    auto const& nvme1 = devices[1];
+    expect(devices[1].first == 5);
+    expect(devices[2].first == 9);
+    expect(nvme0.cost() == 132);
+    expect(devices[2].cost() == 10512);
+
+    // The first evictions alternate between the fast devices.
+    auto const rw = PageEntry::read | PageEntry::write;
+    std::vector<std::uint16_t> pages;
+    for (std::uint16_t i = 0; i < 40; ++i) {
+      auto const va = static_cast<std::uint16_t>(0x1000 + (i << 8));
+      m.store_byte(std::byte(i), m.allocate_page(va, rw));
+      pages.push_back(va);
+    }
+    expect(nothrow([&] { check_invariants(m); }));
+    std::vector<std::uint16_t> slots;
+    for (auto va : pages) {
+      auto const pte = *m.lookup_entry(va);
+      if (!pte.is_present()) { slots.push_back(pte.frame()); }
+    }
+    expect(slots.size() > 8);
+    expect(slots[0] == 1);
+    expect(slots[1] == 5);
+    expect(slots[2] == 2);
+    expect(slots[3] == 6);
+    expect(slots[8] == 9);
+    expect(nvme0.statistics.writes == 4);
+    expect(nvme1.statistics.writes == 4);
+    expect(devices[2].statistics.writes == slots.size() - 8);
+
+    // Reads are charged at the cost of the device holding the page.
+    auto const before = m.latency.total().cycles;
+    expect(m.read_byte(m.translate(pages[0], PageEntry::read)) == std::byte{0});
+    expect(nvme0.statistics.reads == 1);
+    expect(m.latency.total().cycles - before >= nvme0.cost());
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+      expect(m.read_byte(m.translate(pages[i], PageEntry::read)) == std::byte(i));
+    }
+    expect(devices[2].statistics.reads > 0);
+    expect(nothrow([&] { check_invariants(m); }));
+
+    // The pages read back release their slots, and victims keep filling the fast devices first.
+    expect(nvme0.allocated_count() == 4_u);
+    expect(nvme1.allocated_count() == 4_u);
+
+    // Once the fast devices have drained, their slots are reused before the slow device's.
+    m.simple_munmap(VirtualAddress(0x1000), pages.size() << 8);
+    for (auto const& d : devices) { expect(d.allocated_count() == 0_u); }
+    expect(nothrow([&] { check_invariants(m); }));
+    auto const slow_writes = devices[2].statistics.writes;
+    for (std::uint16_t i = 0; (i < 40) && (nvme0.allocated_count() < 4); ++i) {
+      auto const va = static_cast<std::uint16_t>(0x1000 + (i << 8));
+      m.store_byte(std::byte(i), m.allocate_page(va, rw));
+    }
+    expect(nvme0.allocated_count() == 4_u);
+    expect(nvme1.allocated_count() >= 3_u);
+    expect(devices[2].statistics.writes == slow_writes);
+    expect(nothrow([&] { check_invariants(m); }));
+
+    // Devices cannot be added once the default region has allocated slots.
+    Machine n;
+    for (std::uint16_t i = 0; i < 20; ++i) {
+      n.allocate_page(static_cast<std::uint16_t>(0x1000 + (i << 8)), rw);
+    }
+    expect(throws<std::invalid_argument>([&] { n.add_swap_device(1, 100, 10, 1.0); }));
+    expect(nothrow([&] { check_invariants(n); }));
+    n.swap_devices.add(1, 100, 10, 1.0);
+    expect(throws<InvariantViolation>([&] { check_invariants(n); }));
+  };
+
+  "memory_balloon"_test = [] {
+    Machine m;
+    auto const rw = PageEntry::read | PageEntry::write;
+    std::vector<std::uint16_t> pages;
+    for (std::uint16_t i = 0; i < 10; ++i) {
+      auto const va = static_cast<std::uint16_t>(0x1000 + (i << 8));
+      m.store_byte(std::byte(i + 1), m.allocate_page(va, rw));
+      pages.push_back(va);
+    }
+    auto const check_pages = [&] {
+      for (std::size_t i = 0; i < pages.size(); ++i) {
+        expect(m.read_byte(m.translate(pages[i], PageEntry::read)) == std::byte(i + 1));
+      }
+      expect(nothrow([&] { check_invariants(m); }));
+    };
+
+    // The balloon takes free frames first, then frames storing pages.
+    auto const free = m.free_frame_count();
+    expect(m.inflate_balloon(free) == free);
+    expect(m.free_frame_count() == 0);
+    expect(m.balloon_statistics.evictions + m.balloon_statistics.migrations == 0);
+    expect(m.inflate_balloon(3) == 3);
+    expect(m.online_frame_count() == 16 - free - 3);
+    expect(m.balloon_statistics.evictions == 3);
+    check_pages();
+
+    // The kernel's frames are never taken.
+    expect(m.inflate_balloon(16) < 16);
+    expect(m.online_frame_count() >= Machine::max_kernel_frames);
+    expect(throws<std::invalid_argument>([&] { m.remove_frame(0); }));
+    check_pages();
+
+    // Deflating gives the frames back.
+    m.deflate_balloon(16);
+    expect(m.removed_frames == 0);
+    expect(m.online_frame_count() == 16);
+    check_pages();
+
+    // Hot-unplugging frames moves their pages to the remaining frames.
+    m.set_frame_count(8);
+    expect(m.removed_frames == 0xff00);
+    expect(m.balloon_statistics.migrations > 0);
+    check_pages();
+    m.set_frame_count(16);
+    expect(m.removed_frames == 0);
+    expect(throws<std::invalid_argument>([&] { m.set_frame_count(2); }));
+    check_pages();
+  };
+
   return 0;
 }
@@ -5,7 +5,10 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <deque>
 #include <forward_list>
+#include <functional>
+#include <limits>
 #include <vector>
 
 namespace sch {
@@ -33,6 +36,35 @@ struct Task {
 /// An collection of tasks.
 using TaskList = std::vector<Task>;
 
+/// A function stepping the task at the given index and returning `true` iff it stepped.
+///
+/// The executor defines where the programs of the tasks are evaluated. By default, programs are
+/// evaluated in host memory (see `step_in_host`).
+using Executor = std::function<bool(std::size_t, Task&)>;
+
+/// Performs the one step reduction of the program of `task`, in host memory, and returns `true`
+/// iff it stepped.
+inline bool step_in_host(std::size_t, Task& task) {
+  return lambda::step(task.program);
+}
+
+/// Statistics about the memory usage of a task.
+struct MemoryUsage {
+
+  /// The number of pages the task accessed recently.
+  std::size_t working_set = 0;
+
+  /// The number of memory accesses of the task so far.
+  std::uint64_t accesses = 0;
+
+  /// The number of major page faults raised by the task so far.
+  std::uint64_t faults = 0;
+
+};
+
+/// A function returning the memory usage of the task at the given index.
+using MemoryMonitor = std::function<MemoryUsage(std::size_t)>;
+
 /// The execution of scheduling algorithm for processing tasks on a system using `core_count` CPUs.
 template<std::size_t core_count>
 struct Scheduler {
@@ -72,10 +104,14 @@ private:
   /// The IDs of the task not yet completed.
   std::forward_list<std::size_t> work;
 
+  /// The function stepping the tasks.
+  Executor execute;
+
 public:
 
-  /// Initializes the state of a scheduler applying this strategy to process `tasks`.
-  FCFS(TaskList& tasks) : tasks(tasks) {
+  /// Initializes the state of a scheduler applying this strategy to process `tasks`, stepping them
+  /// with `execute`.
+  FCFS(TaskList& tasks, Executor execute = step_in_host) : tasks(tasks), execute(execute) {
     // Fill `work` with task indices, in reverse order.
     for (std::size_t i = tasks.size(); i > 0; --i) { work.push_front(i - 1); }
   }
@@ -93,7 +129,7 @@ public:
       assert(task.state != Task::Terminated);
 
       // Does the task step?
-      if (lambda::step(task.program)) {
+      if (execute(*j, task)) {
         task.state = Task::Running;
         i = j++;
       } else {
@@ -151,4 +187,193 @@ public:
 
 };
 
+/// The execution of scheduling algorithm adopting round-robin scheduling under load control.
+///
+/// The scheduler prevents thrashing by limiting the tasks competing for memory, following
+/// Denning's working set model. Tasks are either *active*, in which case they are run in turn,
+/// or *suspended*, in which case they wait in a queue until memory is available. The memory usage
+/// of each task is sampled with `monitor` after each of its steps, and
+///
+/// - a task is activated if the sum of the working sets of the active tasks and its own last
+///   known working set fits in `frame_budget` frames, and the last step did not fault at a rate
+///   above `max_fault_rate` faults per access;
+/// - active tasks are suspended while these conditions do not hold after a step, choosing the
+///   task with the lowest priority and, among those, the one activated last;
+/// - an active task is suspended after `quantum` consecutive steps if other tasks are suspended,
+///   so that suspended tasks do not starve.
+///
+/// At least one task is always active, so that the system progresses even if a single working
+/// set exceeds the budget.
+template<std::size_t core_count>
+struct LoadControl final : public Scheduler<core_count> {
+
+  static_assert(core_count > 0);
+
+  /// Statistics about a scheduler.
+  struct Statistics {
+
+    /// The number of times a task has been activated.
+    std::size_t activations = 0;
+
+    /// The number of times a task has been suspended because of memory pressure.
+    std::size_t suspensions = 0;
+
+    /// The number of times a task has been suspended at the end of its quantum.
+    std::size_t rotations = 0;
+
+  };
+
+  /// The number of frames available to the working sets of the active tasks.
+  std::size_t frame_budget;
+
+  /// The fault rate, in faults per access, above which the memory is considered overcommitted.
+  double max_fault_rate = 0.01;
+
+  /// The maximum number of consecutive steps of a task while other tasks are suspended.
+  std::size_t quantum = 64;
+
+  /// Statistics about this scheduler.
+  Statistics statistics;
+
+private:
+
+  /// The tasks to process.
+  TaskList& tasks;
+
+  /// The function stepping the tasks.
+  Executor execute;
+
+  /// The function sampling the memory usage of the tasks.
+  MemoryMonitor monitor;
+
+  /// The IDs of the active tasks, in the order in which they have been activated.
+  std::vector<std::size_t> active;
+
+  /// The IDs of the suspended tasks, in the order in which they will be activated.
+  std::deque<std::size_t> suspended;
+
+  /// The last memory usage of each task.
+  std::vector<MemoryUsage> usage;
+
+  /// The number of consecutive steps of each task since it has been activated.
+  std::vector<std::size_t> streak;
+
+  /// The index in `active` of the next task to run.
+  std::size_t cursor = 0;
+
+  /// The fault rate of the last step.
+  double fault_rate = 0;
+
+public:
+
+  /// Initializes the state of a scheduler applying this strategy to process `tasks`, stepping them
+  /// with `execute` and sampling their memory usage with `monitor`.
+  LoadControl(
+    TaskList& tasks, Executor execute, MemoryMonitor monitor, std::size_t frame_budget
+  ) : frame_budget(frame_budget), tasks(tasks), execute(execute), monitor(monitor),
+      usage(tasks.size()), streak(tasks.size())
+  {
+    for (std::size_t i = 0; i < tasks.size(); ++i) { suspended.push_back(i); }
+  }
+
+  /// Returns the sum of the working sets of the active tasks.
+  std::size_t load() const {
+    std::size_t n = 0;
+    for (auto const i : active) { n += usage[i].working_set; }
+    return n;
+  }
+
+  /// Returns the number of active tasks.
+  std::size_t active_count() const { return active.size(); }
+
+  bool step() {
+    // Is there any work left?
+    if (active.empty() && suspended.empty()) { return false; }
+
+    // Activate suspended tasks while there is room for their working sets.
+    while (!suspended.empty()) {
+      auto const i = suspended.front();
+      usage[i] = monitor(i);
+      auto const fits = load() + std::max<std::size_t>(usage[i].working_set, 1) <= frame_budget;
+      if (!active.empty() && !(fits && (fault_rate <= max_fault_rate))) { break; }
+      suspended.pop_front();
+      active.push_back(i);
+      streak[i] = 0;
+      statistics.activations++;
+    }
+
+    // Step the next active tasks in turn.
+    for (auto& task : tasks) {
+      if (!task.terminated()) { task.state = Task::Ready; }
+    }
+
+    std::uint64_t accesses = 0;
+    std::uint64_t faults = 0;
+    auto const n = std::min(core_count, active.size());
+    for (std::size_t k = 0; k < n; ++k) {
+      if (cursor >= active.size()) { cursor = 0; }
+      auto const i = active[cursor];
+      auto& task = tasks.at(i);
+      auto const stepped = execute(i, task);
+
+      // Sample the memory usage of the task.
+      auto const u = monitor(i);
+      accesses += u.accesses - usage[i].accesses;
+      faults += u.faults - usage[i].faults;
+      usage[i] = u;
+
+      // Does the task step?
+      if (stepped) {
+        task.state = Task::Running;
+        streak[i]++;
+        cursor++;
+      } else {
+        task.state = Task::Terminated;
+        active.erase(active.begin() + static_cast<std::ptrdiff_t>(cursor));
+      }
+    }
+    fault_rate = (accesses == 0) ? 0 : static_cast<double>(faults) / accesses;
+
+    // Suspend tasks while the memory is overcommitted.
+    auto thrashing = fault_rate > max_fault_rate;
+    while ((active.size() > 1) && (thrashing || (load() > frame_budget))) {
+      suspend(victim());
+      statistics.suspensions++;
+      thrashing = false;
+    }
+
+    // Suspend a task that ran for a whole quantum while others are waiting.
+    if (!suspended.empty()) {
+      for (std::size_t k = 0; k < active.size(); ++k) {
+        if (streak[active[k]] >= quantum) {
+          suspend(k);
+          statistics.rotations++;
+          break;
+        }
+      }
+    }
+
+    return true;
+  }
+
+private:
+
+  /// Returns the index in `active` of the task to suspend when memory is overcommitted.
+  std::size_t victim() const {
+    std::size_t result = 0;
+    for (std::size_t k = 1; k < active.size(); ++k) {
+      if (tasks.at(active[k]).priority <= tasks.at(active[result]).priority) { result = k; }
+    }
+    return result;
+  }
+
+  /// Suspends the task at index `k` in `active`.
+  void suspend(std::size_t k) {
+    suspended.push_back(active[k]);
+    active.erase(active.begin() + static_cast<std::ptrdiff_t>(k));
+    if (cursor > k) { cursor--; }
+  }
+
+};
+
 } // namespace sch
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "Lambda.hh"
+#include "Scheduler.hh"
+
+#include "mmu.hh"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace vm {
+
+/// The address of a node in the memory of a simulated machine.
+using Address = std::uint16_t;
+
+/// A node of a term stored in the memory of a simulated machine.
+///
+/// A node occupies 8 bytes, holding three 16-bit fields followed by 2 bytes of padding, so that
+/// nodes never straddle a page boundary.
+struct Node {
+
+  /// The kind of a node.
+  enum Kind : std::uint16_t { Unit, Var, Abs, App };
+
+  /// The size of a node in memory, in bytes.
+  static constexpr std::size_t size = 8;
+
+  /// The kind of this node.
+  Kind kind;
+
+  /// The identity of the variable, the parameter of the abstraction, or the address of the
+  /// callee, depending on `kind`.
+  std::uint16_t a = 0;
+
+  /// The address of the body of the abstraction or of the argument, depending on `kind`.
+  std::uint16_t b = 0;
+
+};
+
+/// Returns the number of major faults counted in `c`, i.e., the faults that read a page from the
+/// compressed pool, from secondary memory, or from a file.
+///
+/// Minor faults, which map a page that is already in memory or zero-fill a new one, are excluded:
+/// they do not indicate that the memory is overcommitted.
+std::uint64_t major_faults(mmu::LatencyStatistics::Core const& c);
+
+/// A process evaluating a program stored in the memory of a `System`.
+struct Process {
+
+  /// Statistics about a process.
+  struct Statistics {
+
+    /// The number of reduction steps.
+    std::size_t steps = 0;
+
+    /// The number of memory accesses.
+    std::uint64_t accesses = 0;
+
+    /// The cost of the memory accesses, in cycles.
+    std::uint64_t cycles = 0;
+
+    /// The number of major faults raised by the memory accesses (see `major_faults`).
+    std::uint64_t faults = 0;
+
+  };
+
+  /// The address of the root of the program.
+  Address root = 0;
+
+  /// The protection key of the pages of the process.
+  std::uint8_t key;
+
+  /// The pages storing the nodes of the process.
+  std::vector<Address> pages;
+
+  /// The address of the next node to allocate, or a page boundary if the last page is full.
+  Address next = 0;
+
+  /// The addresses of the nodes that are no longer reachable, which are allocated first.
+  std::vector<Address> free_nodes;
+
+  /// `true` iff the process has been killed because the system ran out of memory.
+  bool killed = false;
+
+  /// Statistics about the process.
+  Statistics statistics;
+
+  /// The virtual time of the process, in node accesses.
+  std::uint64_t clock = 0;
+
+  /// The virtual time of the last access to each page, indexed by page number, or 0 if the page
+  /// has not been accessed.
+  std::array<std::uint64_t, 256> last_touch = {};
+
+  /// Returns the number of pages of the process accessed within the last `window` accesses of the
+  /// process, which estimates its working set in the sense of Denning's working set model.
+  ///
+  /// The window is measured in the virtual time of the process, so that the working set of a
+  /// process is preserved while it is not running.
+  std::size_t working_set(std::uint64_t window) const;
+
+};
+
+/// A simulated operating system evaluating the programs of processes in virtual memory.
+///
+/// The programs are stored as graphs of `Node`s in the memory of a simulated `mmu::Machine`, and
+/// reduced there: every node read or written is an access translated by the machine, so that
+/// reductions cause TLB misses, page faults, and swapping as the processes compete for frames.
+/// The reduction follows the semantics of `lambda::step` exactly. Nodes are never shared, so that
+/// the nodes that become unreachable after a reduction (i.e., the application, the abstraction
+/// and the argument, which has been copied) are returned to a free list and reused.
+///
+/// The machine has a single translation table, so the processes share one virtual address space,
+/// in which each process maps its own pages with `simple_mmap`. The pages of a process are tagged
+/// with a protection key that only grants access while that process is running. Switching to
+/// another process changes the rights of the keys and flushes the TLB, as an operating system
+/// switching address spaces without tagged TLB entries would.
+///
+/// These choices limit the size of the simulated system: at most 15 processes can run, since the
+/// machine has 16 protection keys and key 0 is the default one, and the live nodes of all
+/// processes must fit in the 248 pages of user space, i.e., about 7.9K nodes in total. A process
+/// whose reduction runs out of memory is killed, releasing its pages and its protection key, rather
+/// than propagating `std::bad_alloc` to the scheduler.
+struct System {
+
+  /// The machine running the processes.
+  std::unique_ptr<mmu::Machine> machine = std::make_unique<mmu::Machine>();
+
+  /// The processes, indexed by their identity.
+  std::vector<Process> processes;
+
+  /// The identity of the running process, if any.
+  std::optional<std::size_t> current;
+
+  /// The number of context switches so far.
+  std::size_t context_switches = 0;
+
+  /// The window of the working sets of the processes, in node accesses (see
+  /// `Process::working_set`).
+  std::uint64_t working_set_window = 64;
+
+  /// Creates a process evaluating `program` and returns its identity.
+  ///
+  /// The method throws `std::bad_alloc`, creating no process, if there is no protection key left
+  /// or if `program` does not fit in memory.
+  std::size_t spawn(lambda::Term const& program);
+
+  /// Creates a process for each task in `tasks`, in order, so that the identity of each process
+  /// is the index of its task.
+  void spawn(sch::TaskList const& tasks);
+
+  /// Makes `pid` the running process.
+  void switch_to(std::size_t pid);
+
+  /// Performs the one step reduction of the program of `pid` and returns `true` iff it stepped.
+  ///
+  /// If the machine runs out of memory during the reduction, the process is killed and the
+  /// method returns `false`. The method always returns `false` for a killed process.
+  bool step(std::size_t pid);
+
+  /// Returns the program of `pid`, read from the memory of the machine.
+  ///
+  /// - Requires: `pid` has not been killed.
+  lambda::Term program(std::size_t pid);
+
+  /// Returns an executor stepping the tasks of a scheduler in the processes of this system (see
+  /// `spawn(sch::TaskList const&)`).
+  ///
+  /// The programs of the tasks are left unchanged: the current program of a task is returned by
+  /// `program`.
+  sch::Executor executor();
+
+  /// Returns the memory usage of `pid`.
+  sch::MemoryUsage usage(std::size_t pid) const;
+
+  /// Returns a monitor reporting the memory usage of the processes of this system to a scheduler
+  /// (see `spawn(sch::TaskList const&)`).
+  sch::MemoryMonitor monitor() const;
+
+  /// Returns the number of frames in which the machine can store the pages of the processes.
+  std::size_t frame_budget() const;
+
+private:
+
+  /// Returns a new node of `p`, reusing a free node or mapping a new page if necessary.
+  Address allocate(Process& p);
+
+  /// Returns the node at `a`, which is no longer reachable, to the free list of `p`.
+  void release(Process& p, Address a);
+
+  /// Returns the nodes of the term at `a`, which is no longer reachable, to the free list of `p`.
+  void release_term(Process& p, Address a);
+
+  /// Kills `pid`, unmapping its pages and freeing its protection key.
+  void kill(std::size_t pid);
+
+  /// Returns the node at `a` without recording the access in the working set of a process.
+  Node read(Address a);
+
+  /// Writes `n` at `a` without recording the access in the working set of a process.
+  void write(Address a, Node const& n);
+
+  /// Returns the node of `p` at `a`.
+  Node load(Process& p, Address a);
+
+  /// Writes `n` at `a`, which is a node of `p`.
+  void store(Process& p, Address a, Node const& n);
+
+  /// Stores `t` in the memory of `p` and returns its address.
+  Address encode(Process& p, lambda::Term const& t);
+
+  /// Returns the term stored at `a`.
+  lambda::Term decode(Address a);
+
+  /// Returns the address of a copy of the term at `a`, allocated in `p`.
+  Address copy(Process& p, Address a);
+
+  /// Substitutes the free occurrences of `x` in the term at `a` for copies of the term at `u`,
+  /// updating the term in place, and returns its address.
+  Address substitute(Process& p, Address a, std::uint16_t x, Address u);
+
+  /// Performs the one step reduction of the term at `a` and returns its address if it stepped.
+  std::optional<Address> reduce(Process& p, Address a);
+
+};
+
+} // namespace vm
@@ -0,0 +1,288 @@
+#include "VirtualMemory.hh"
+
+#include <cassert>
+#include <new>
+
+namespace vm {
+
+std::uint64_t major_faults(mmu::LatencyStatistics::Core const& c) {
+  return c.count(mmu::Event::pool_read) + c.count(mmu::Event::swap_read)
+    + c.count(mmu::Event::file_read);
+}
+
+std::size_t Process::working_set(std::uint64_t window) const {
+  std::size_t n = 0;
+  for (auto const page : pages) {
+    auto const t = last_touch[page >> 8];
+    if ((t != 0) && (clock - t < window)) { n++; }
+  }
+  return n;
+}
+
+std::size_t System::spawn(lambda::Term const& program) {
+  auto& p = processes.emplace_back();
+  try {
+    p.key = machine->pkey_alloc();
+  } catch (...) {
+    processes.pop_back();
+    throw;
+  }
+  auto const pid = processes.size() - 1;
+  switch_to(pid);
+  try {
+    p.root = encode(p, program);
+  } catch (std::bad_alloc const&) {
+    kill(pid);
+    processes.pop_back();
+    throw;
+  }
+  return pid;
+}
+
+void System::spawn(sch::TaskList const& tasks) {
+  for (auto const& t : tasks) { spawn(t.program); }
+}
+
+void System::switch_to(std::size_t pid) {
+  if (current == pid) { return; }
+  if (current.has_value()) {
+    machine->pkey_set(processes.at(*current).key, mmu::Machine::pkey_disable_access);
+  }
+  machine->pkey_set(processes.at(pid).key, 0);
+  machine->tlb = {};
+  current = pid;
+  context_switches++;
+}
+
+bool System::step(std::size_t pid) {
+  auto& p = processes.at(pid);
+  if (p.killed) { return false; }
+  switch_to(pid);
+  auto const before = machine->latency.total();
+
+  std::optional<Address> r;
+  try {
+    r = reduce(p, p.root);
+  } catch (std::bad_alloc const&) {
+    kill(pid);
+  }
+  if (r.has_value()) {
+    p.root = *r;
+    p.statistics.steps++;
+  }
+
+  auto const after = machine->latency.total();
+  p.statistics.accesses += after.accesses - before.accesses;
+  p.statistics.cycles += after.cycles - before.cycles;
+  p.statistics.faults += major_faults(after) - major_faults(before);
+  return r.has_value();
+}
+
+lambda::Term System::program(std::size_t pid) {
+  assert(!processes.at(pid).killed);
+  switch_to(pid);
+  return decode(processes.at(pid).root);
+}
+
+sch::Executor System::executor() {
+  return [this](std::size_t i, sch::Task&) { return step(i); };
+}
+
+sch::MemoryUsage System::usage(std::size_t pid) const {
+  auto const& p = processes.at(pid);
+  return {p.working_set(working_set_window), p.statistics.accesses, p.statistics.faults};
+}
+
+sch::MemoryMonitor System::monitor() const {
+  return [this](std::size_t i) { return usage(i); };
+}
+
+std::size_t System::frame_budget() const {
+  auto const* frame_table = machine->frame_table();
+  std::size_t n = 0;
+  for (std::size_t f = mmu::Machine::max_kernel_frames; f < 16; ++f) {
+    if (!frame_table[f].is_pinned()) { n++; }
+  }
+  return n;
+}
+
+Address System::allocate(Process& p) {
+  if (!p.free_nodes.empty()) {
+    auto const a = p.free_nodes.back();
+    p.free_nodes.pop_back();
+    return a;
+  }
+  if ((p.next & 0xff) == 0) {
+    auto const rw = mmu::PageEntry::read | mmu::PageEntry::write;
+    auto const page = machine->simple_mmap(0, 256, rw);
+    machine->pkey_mprotect(page, 256, p.key);
+    p.pages.push_back(page.raw);
+    p.next = page.raw;
+  }
+  auto const a = p.next;
+  p.next = static_cast<Address>(p.next + Node::size);
+  return a;
+}
+
+void System::release(Process& p, Address a) {
+  p.free_nodes.push_back(a);
+}
+
+void System::release_term(Process& p, Address a) {
+  auto const n = load(p, a);
+  if (n.kind == Node::Abs) {
+    release_term(p, n.b);
+  } else if (n.kind == Node::App) {
+    release_term(p, n.a);
+    release_term(p, n.b);
+  }
+  release(p, a);
+}
+
+void System::kill(std::size_t pid) {
+  auto& p = processes.at(pid);
+  for (auto const page : p.pages) { machine->simple_munmap(page, 256); }
+  machine->pkey_free(p.key);
+  if (current == pid) { current.reset(); }
+  p.pages.clear();
+  p.free_nodes.clear();
+  p.next = 0;
+  p.root = 0;
+  p.killed = true;
+}
+
+Node System::read(Address a) {
+  auto const pa = machine->translate(a, mmu::PageEntry::read);
+  std::uint16_t fields[3];
+  for (std::uint16_t i = 0; i < 3; ++i) {
+    auto const lo = machine->read_byte({static_cast<std::uint16_t>(pa.raw + 2 * i)});
+    auto const hi = machine->read_byte({static_cast<std::uint16_t>(pa.raw + 2 * i + 1)});
+    fields[i] = static_cast<std::uint16_t>(std::to_integer<unsigned>(lo)
+      | (std::to_integer<unsigned>(hi) << 8));
+  }
+  return {static_cast<Node::Kind>(fields[0]), fields[1], fields[2]};
+}
+
+void System::write(Address a, Node const& n) {
+  auto const pa = machine->translate(a, mmu::PageEntry::write);
+  std::uint16_t const fields[3] = {n.kind, n.a, n.b};
+  for (std::uint16_t i = 0; i < 3; ++i) {
+    machine->store_byte(std::byte(fields[i] & 0xff), {static_cast<std::uint16_t>(pa.raw + 2 * i)});
+    machine->store_byte(std::byte(fields[i] >> 8), {static_cast<std::uint16_t>(pa.raw + 2 * i + 1)});
+  }
+}
+
+Node System::load(Process& p, Address a) {
+  p.last_touch[a >> 8] = ++p.clock;
+  return read(a);
+}
+
+void System::store(Process& p, Address a, Node const& n) {
+  p.last_touch[a >> 8] = ++p.clock;
+  write(a, n);
+}
+
+Address System::encode(Process& p, lambda::Term const& t) {
+  auto const a = allocate(p);
+  auto const n = std::visit([&](auto&& u) -> Node {
+    using T = std::decay_t<decltype(u)>;
+    if constexpr (std::is_same_v<T, lambda::Unit>) {
+      return {Node::Unit};
+    } else if constexpr (std::is_same_v<T, lambda::Var>) {
+      return {Node::Var, static_cast<std::uint16_t>(u.id)};
+    } else if constexpr (std::is_same_v<T, lambda::Abs>) {
+      return {Node::Abs, static_cast<std::uint16_t>(u.parameter.id), encode(p, *u.body)};
+    } else {
+      return {Node::App, encode(p, *u.callee), encode(p, *u.argument)};
+    }
+  }, t);
+  store(p, a, n);
+  return a;
+}
+
+lambda::Term System::decode(Address a) {
+  auto const n = read(a);
+  switch (n.kind) {
+    case Node::Unit:
+      return lambda::Unit{};
+    case Node::Var:
+      return lambda::Var{n.a};
+    case Node::Abs:
+      return lambda::Abs{n.a, decode(n.b)};
+    default:
+      return lambda::App{decode(n.a), decode(n.b)};
+  }
+}
+
+Address System::copy(Process& p, Address a) {
+  auto n = load(p, a);
+  if (n.kind == Node::Abs) {
+    n.b = copy(p, n.b);
+  } else if (n.kind == Node::App) {
+    n.a = copy(p, n.a);
+    n.b = copy(p, n.b);
+  }
+  auto const result = allocate(p);
+  store(p, result, n);
+  return result;
+}
+
+Address System::substitute(Process& p, Address a, std::uint16_t x, Address u) {
+  auto n = load(p, a);
+  switch (n.kind) {
+    case Node::Unit:
+      return a;
+    case Node::Var:
+      if (n.a != x) { return a; }
+      release(p, a);
+      return copy(p, u);
+    case Node::Abs:
+      if (n.a == x) { return a; }
+      n.b = substitute(p, n.b, x, u);
+      break;
+    default:
+      n.a = substitute(p, n.a, x, u);
+      n.b = substitute(p, n.b, x, u);
+      break;
+  }
+  store(p, a, n);
+  return a;
+}
+
+std::optional<Address> System::reduce(Process& p, Address a) {
+  auto n = load(p, a);
+
+  // Is the term an abstraction that is not in normal form?
+  if (n.kind == Node::Abs) {
+    auto const b = reduce(p, n.b);
+    if (!b.has_value()) { return std::nullopt; }
+    if (*b != n.b) { store(p, a, {Node::Abs, n.a, *b}); }
+    return a;
+  }
+
+  // The term a normal form.
+  if (n.kind != Node::App) { return std::nullopt; }
+
+  // Does the callee or the argument step?
+  if (auto const c = reduce(p, n.a); c.has_value()) {
+    if (*c != n.a) { store(p, a, {Node::App, *c, n.b}); }
+    return a;
+  }
+  if (auto const u = reduce(p, n.b); u.has_value()) {
+    if (*u != n.b) { store(p, a, {Node::App, n.a, *u}); }
+    return a;
+  }
+
+  // Is the callee an abstraction?
+  auto const f = load(p, n.a);
+  if (f.kind != Node::Abs) { return std::nullopt; }
+  auto const result = substitute(p, f.b, f.a, n.b);
+
+  // The application, the callee and the argument, which has been copied, are now unreachable.
+  release(p, a);
+  release(p, n.a);
+  release_term(p, n.b);
+  return result;
+}
+
+} // namespace vm
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Church.hh"
+#include "Scheduler.hh"
+
+#include <cstddef>
+
+/// Returns a few tasks of various priorities, the first of which never terminates.
+inline sch::TaskList sample_tasks() {
+  using namespace lambda;
+  auto const t = church::tru();
+  auto const f = church::fls();
+  auto const z = church::number(0);
+  auto const s = church::successor();
+  return {
+    sch::Task{loopy(), 4},
+    sch::Task{App{App{church::land(), t}, f}, 3},
+    sch::Task{App{App{church::lor(), t}, f}, 2},
+    sch::Task{let(0, z, App{s, z}), 1},
+    sch::Task{App{s, App{s, z}}, 0},
+  };
+}
+
+/// Returns `n` tasks adding Church numerals, whose combined working sets exceed main memory for
+/// more than 4 tasks when evaluated by a `vm::System`.
+inline sch::TaskList church_workload(std::size_t n) {
+  using namespace lambda;
+  sch::TaskList tasks;
+  for (std::size_t i = 0; i < n; ++i) {
+    auto const k = church::number(4 + 2 * (i % 4));
+    tasks.push_back(sch::Task{App{App{k, church::successor()}, k}});
+  }
+  return tasks;
+}
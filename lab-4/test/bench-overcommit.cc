@@ -0,0 +1,70 @@
+#include "Scheduler.hh"
+#include "VirtualMemory.hh"
+#include "Workloads.hh"
+
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+/// The number of scheduler steps simulated by each run.
+constexpr std::size_t max_fuel = 400;
+
+/// The result of a run of the benchmark.
+struct Run {
+
+  /// The number of reduction steps performed by all processes.
+  std::size_t steps = 0;
+
+  /// The total cost of the memory accesses, in cycles.
+  std::uint64_t cycles = 0;
+
+  /// The number of major page faults (see `vm::major_faults`).
+  std::uint64_t faults = 0;
+
+  /// The number of context switches.
+  std::size_t context_switches = 0;
+
+  /// Returns the number of reduction steps per million cycles.
+  double throughput() const {
+    return (cycles == 0) ? 0.0 : 1e6 * static_cast<double>(steps) / static_cast<double>(cycles);
+  }
+
+};
+
+/// Runs `n` tasks on a fresh system and returns the result, enabling load control iff `controlled`
+/// is `true`.
+Run run(std::size_t n, bool controlled) {
+  vm::System system;
+  auto tasks = church_workload(n);
+  system.spawn(tasks);
+  auto const start = system.machine->latency.total();
+
+  auto const budget = controlled ? system.frame_budget() : std::numeric_limits<std::size_t>::max();
+  sch::LoadControl<1> scheduler{tasks, system.executor(), system.monitor(), budget};
+  if (!controlled) { scheduler.max_fault_rate = std::numeric_limits<double>::infinity(); }
+  for (std::size_t fuel = max_fuel; (fuel > 0) && scheduler.step(); --fuel) {}
+
+  auto const end = system.machine->latency.total();
+  Run r;
+  for (auto const& p : system.processes) { r.steps += p.statistics.steps; }
+  r.cycles = end.cycles - start.cycles;
+  r.faults = vm::major_faults(end) - vm::major_faults(start);
+  r.context_switches = system.context_switches;
+  return r;
+}
+
+/// Measures the throughput of a system running an increasing number of processes, with and
+/// without load control.
+int main() {
+  std::cout << "processes,control,steps,cycles,faults,context_switches,steps_per_mcycle\n";
+  for (std::size_t n = 1; n <= 12; ++n) {
+    for (auto const controlled : {false, true}) {
+      auto const r = run(n, controlled);
+      std::cout << n << ',' << (controlled ? "on" : "off") << ',' << r.steps << ',' << r.cycles
+        << ',' << r.faults << ',' << r.context_switches << ',' << std::fixed << std::setprecision(2)
+        << r.throughput() << std::defaultfloat << '\n';
+    }
+  }
+  return 0;
+}
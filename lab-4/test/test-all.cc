@@ -1,5 +1,7 @@
 #include "Church.hh"
 #include "Scheduler.hh"
+#include "VirtualMemory.hh"
+#include "Workloads.hh"
 
 #include <algorithm>
 #include <boost/ut.hpp>
@@ -100,19 +102,7 @@ int main() {
   "[Schedulers]"_test = [] {
     using namespace lambda;
 
-    auto t = church::tru();
-    auto f = church::fls();
-    auto z = church::number(0);
-    auto s = church::successor();
-
-    // Create some tasks.
-    sch::TaskList tasks = {
-      sch::Task{loopy(), 4},
-      sch::Task{App{App{church::land(), t}, f}, 3},
-      sch::Task{App{App{church::lor(), t}, f}, 2},
-      sch::Task{let(0, z, App{s, z}), 1},
-      sch::Task{App{s, App{s, z}}, 0},
-    };
+    auto const tasks = sample_tasks();
 
     "[FCFS]"_test = [ts = tasks] mutable {
       auto r = test_scheduler<sch::FCFS, 2>(ts);
@@ -140,5 +130,155 @@ int main() {
     // };
   };
 
+  "[Virtual memory]"_test = [] {
+    using namespace lambda;
+
+    auto const tasks = sample_tasks();
+
+    should("reduce programs in virtual memory as in host memory") = [ts = tasks] mutable {
+      vm::System system;
+      system.spawn(ts);
+      sch::TaskList reference = ts;
+
+      // Record the processes in the order in which the scheduler steps them.
+      std::vector<std::size_t> trace;
+      auto const execute = [&, e = system.executor()](std::size_t i, sch::Task& t) {
+        trace.push_back(i);
+        return e(i, t);
+      };
+      auto const spawned = system.context_switches;
+
+      sch::FCFS<2> scheduler{ts, execute};
+      sch::FCFS<2> expected{reference};
+      for (std::size_t i = 0; (i < max_fuel) && scheduler.step(); ++i) {
+        expected.step();
+        for (std::size_t j = 0; j < ts.size(); ++j) {
+          expect(ts.at(j).state == reference.at(j).state);
+        }
+      }
+
+      // The system switches contexts exactly when the running process changes.
+      std::size_t switches = 0;
+      for (std::size_t i = 0; i < trace.size(); ++i) {
+        auto const previous = (i == 0) ? ts.size() - 1 : trace.at(i - 1);
+        if (trace.at(i) != previous) { switches++; }
+      }
+      expect(switches > ts.size());
+      expect(system.context_switches - spawned == switches);
+
+      for (std::size_t j = 0; j < ts.size(); ++j) {
+        expect(system.program(j) == reference.at(j).program);
+      }
+      expect(system.processes.at(1).statistics.steps > 0);
+    };
+
+    should("isolate the memory of processes") = [] {
+      vm::System system;
+      auto const a = system.spawn(identity());
+      system.spawn(identity());
+      auto const page = system.processes.at(a).pages.at(0);
+      auto const cause = [&]() -> int {
+        try {
+          system.machine->translate(page, mmu::PageEntry::read);
+          return 0;
+        } catch (mmu::PageLookupError const& e) {
+          return e.cause;
+        }
+      }();
+      expect(cause == mmu::ProtectionKeyFault);
+      system.switch_to(a);
+      expect(nothrow([&] { system.machine->translate(page, mmu::PageEntry::read); }));
+    };
+
+    should("reuse the nodes that become unreachable") = [] {
+      vm::System system;
+      auto const a = system.spawn(loopy());
+      for (std::size_t i = 0; i < 5000; ++i) { expect(system.step(a)); }
+      expect(system.processes.at(a).pages.size() == 1_u);
+      expect(system.program(a) == loopy());
+    };
+
+    should("kill a process that runs out of memory") = [] {
+      // `(λx. x x x) (λx. x x x)` grows by one application at each step.
+      auto const w = Abs{0, App{App{Var{0}, Var{0}}, Var{0}}};
+      vm::System system;
+      auto const a = system.spawn(App{w, w});
+      auto const b = system.spawn(loopy());
+
+      std::size_t steps = 0;
+      expect(nothrow([&] { while (system.step(a)) { steps++; } }));
+      expect(steps > 1000_u);
+      expect(system.processes.at(a).killed);
+      expect(system.processes.at(a).pages.empty());
+      expect(!system.step(a));
+
+      // The pages and the key of the killed process are available to the others.
+      expect(system.step(b));
+      expect(system.program(b) == loopy());
+      expect(nothrow([&] { for (std::size_t i = 0; i < 14; ++i) { system.spawn(identity()); } }));
+    };
+
+    should("refuse a program that does not fit in memory") = [] {
+      vm::System system;
+      auto const a = system.spawn(loopy());
+      expect(throws<std::bad_alloc>([&] { system.spawn(church::number(5000)); }));
+      expect(system.processes.size() == 1_u);
+      expect(system.step(a));
+      expect(system.program(a) == loopy());
+      expect(nothrow([&] { system.spawn(identity()); }));
+    };
+  };
+
+  "[Load control]"_test = [] {
+    using namespace lambda;
+
+    auto const tasks = sample_tasks();
+
+    should("keep the working sets of active tasks within the budget") = [ts = tasks] mutable {
+      auto const monitor = [](std::size_t) { return sch::MemoryUsage{4, 0, 0}; };
+      sch::LoadControl<2> scheduler{ts, sch::step_in_host, monitor, 8};
+      scheduler.quantum = 4;
+
+      std::vector<std::size_t> progress(ts.size(), 0);
+      for (std::size_t i = 0; (i < max_fuel) && scheduler.step(); ++i) {
+        expect(scheduler.active_count() <= 2);
+        expect(scheduler.load() <= 8);
+        std::size_t running = 0;
+        for (std::size_t j = 0; j < ts.size(); ++j) {
+          if (ts.at(j).running()) { running++; progress.at(j)++; }
+        }
+        expect(running <= 2);
+      }
+
+      // Suspended tasks do not starve.
+      expect(std::all_of(progress.begin(), progress.end(), [](auto i) { return i > 0; }));
+      expect(scheduler.statistics.rotations > 0);
+    };
+
+    should("throttle processes thrashing in virtual memory") = [] {
+      auto const run = [](bool controlled) {
+        auto ts = church_workload(8);
+        sch::TaskList reference = ts;
+
+        vm::System system;
+        system.spawn(ts);
+        auto const budget = controlled ? system.frame_budget() : ts.size() * 256;
+        sch::LoadControl<1> scheduler{ts, system.executor(), system.monitor(), budget};
+        if (!controlled) { scheduler.max_fault_rate = 1; }
+        while (scheduler.step()) {}
+
+        // The programs are evaluated as in host memory.
+        for (std::size_t i = 0; i < ts.size(); ++i) {
+          while (lambda::step(reference.at(i).program)) {}
+          expect(ts.at(i).terminated());
+          expect(system.program(i) == reference.at(i).program);
+        }
+        expect((scheduler.statistics.suspensions > 0) == controlled);
+        return vm::major_faults(system.machine->latency.total());
+      };
+      expect(run(true) < run(false));
+    };
+  };
+
   return 0;
 }